@@ -9,6 +9,24 @@
 #define FC_UTF8KEY (1<<30)
 #define FC_UNDEF (1<<29)
 
+/* Value is a plain scalar stored without Storable (FC_SCALAR in
+ * FastMmap.pm), and for numbers, how it's stored */
+#define FC_SCALAR (1<<23)
+#define FC_IVVAL MMC_IVVAL
+#define FC_NVVAL (1<<21)
+
+/* Flags only used to recreate the key/value SVs */
+#define FC_SVFLAGS (FC_UTF8KEY | FC_UTF8VAL | FC_UNDEF | FC_IVVAL | FC_NVVAL)
+
+/* Value data is a binary number rather than a string */
+#define FC_NUMVAL (MMC_COUNTER | FC_IVVAL | FC_NVVAL)
+
+/* Space for a number stored in its native form */
+typedef union {
+  MI64 iv;
+  NV nv;
+} fc_num;
+
 #define FC_ENTRY \
     mmap_cache * cache; \
     if (!SvROK(obj)) { \
@@ -26,6 +44,397 @@
       XSRETURN_UNDEF; \
     }
 
+/* Value of a native counter entry (see mmc_incr()) */
+static IV fc_counter_iv(void * val_ptr) {
+  MI64 value;
+
+  /* Data is only 4 byte aligned */
+  memcpy(&value, val_ptr, sizeof(MI64));
+  return (IV)value;
+}
+
+/* Set sv to the number in value data with FC_NUMVAL flags */
+static void fc_num_setsv(pTHX_ SV * sv, void * val_ptr, MU32 flags) {
+  fc_num num;
+
+  /* Native counter or integer, return as integer */
+  if (flags & (MMC_COUNTER | FC_IVVAL)) {
+    sv_setiv(sv, fc_counter_iv(val_ptr));
+
+  /* Native floating point number. Data is only 4 byte aligned */
+  } else {
+    memcpy(&num.nv, val_ptr, sizeof(NV));
+    sv_setnv(sv, num.nv);
+  }
+}
+
+/* Create a new SV for value data with the given entry flags */
+static SV * fc_value_sv(pTHX_ void * val_ptr, int val_len, MU32 flags) {
+  SV * val;
+
+  /* Cached an undef value? */
+  if (flags & FC_UNDEF) {
+    val = newSV(0);
+
+  /* Native number */
+  } else if (flags & FC_NUMVAL) {
+    val = newSV(0);
+    fc_num_setsv(aTHX_ val, val_ptr, flags);
+
+  } else {
+
+    /* Create PERL SV */
+    val = newSVpvn((const char *)val_ptr, val_len);
+
+    /* Make UTF8 if stored from UTF8 */
+    if (flags & FC_UTF8VAL) {
+      SvUTF8_on(val);
+    }
+
+  }
+
+  return val;
+}
+
+/* Create mortal SV for a value returned by mmc_read(). Strips
+ * the internal flags from the passed flags on the way */
+static SV * fc_read_sv(pTHX_ int found, void * val_ptr, int val_len, MU32 * flags) {
+  SV * val;
+
+  /* If not found, use undef */
+  if (found == -1)
+    return &PL_sv_undef;
+
+  val = sv_2mortal(fc_value_sv(aTHX_ val_ptr, val_len, *flags));
+  *flags = *flags & ~FC_SVFLAGS;
+
+  return val;
+}
+
+/* Whether a value passed with FC_SCALAR is stored as a native
+ * number, which is if it's only a number and not also a string */
+#define fc_is_native_iv(val) (!SvPOK(val) && !SvNOK(val) && SvIOK(val) && !SvIsUV(val))
+#define fc_is_native_nv(val) (!SvPOK(val) && SvNOK(val))
+
+/* Length of data fc_write_sv() stores for the given value. Avoids
+ * SvPV(), which would make a number a string as well */
+static int fc_write_len(pTHX_ SV * val, MU32 flags) {
+  STRLEN pl_val_len;
+
+  if (!SvOK(val))
+    return 0;
+  if ((flags & FC_SCALAR) && fc_is_native_iv(val))
+    return sizeof(MI64);
+  if ((flags & FC_SCALAR) && fc_is_native_nv(val))
+    return sizeof(NV);
+
+  (void)SvPV(val, pl_val_len);
+  return (int)pl_val_len;
+}
+
+/* With FC_SCALAR, fc_set_many() is passed values already frozen
+ * by the serializer as references to them, since a plain scalar
+ * is never a reference */
+static void fc_set_many_val(pTHX_ SV ** val, MU32 * flags) {
+  if ((*flags & FC_SCALAR) && SvROK(*val)) {
+    *val = SvRV(*val);
+    *flags &= ~FC_SCALAR;
+  }
+}
+
+/* Get data pointer/length to store for the given value, and set
+ * the UTF8/undef flags for the key/value in the passed flags. With
+ * FC_SCALAR, numbers are stored in their native form in num */
+static void fc_write_sv(pTHX_ SV * key, SV * val, void ** val_ptr, int * val_len, MU32 * flags, fc_num * num) {
+  STRLEN pl_val_len;
+
+  /* Check for storing undef, and store empty string with undef flag set */
+  if (!SvOK(val)) {
+    *flags |= FC_UNDEF;
+
+    *val_ptr = "";
+    *val_len = 0;
+
+  } else if ((*flags & FC_SCALAR) && fc_is_native_iv(val)) {
+    num->iv = (MI64)SvIV(val);
+    *flags |= FC_IVVAL;
+
+    *val_ptr = &num->iv;
+    *val_len = sizeof(MI64);
+
+  } else if ((*flags & FC_SCALAR) && fc_is_native_nv(val)) {
+    num->nv = SvNV(val);
+    *flags |= FC_NVVAL;
+
+    *val_ptr = &num->nv;
+    *val_len = sizeof(NV);
+
+  } else {
+
+    /* Get key length, data pointer */
+    *val_ptr = (void *)SvPV(val, pl_val_len);
+    *val_len = (int)pl_val_len;
+
+    /* Set UTF8-ness flag of stored value */
+    if (SvUTF8(val)) {
+      *flags |= FC_UTF8VAL;
+    }
+  }
+  if (SvUTF8(key)) {
+    *flags |= FC_UTF8KEY;
+  }
+}
+
+/* Create a reference to a hash of item details, as returned for
+ * expunged items to write back */
+static SV * fc_item_rv(pTHX_ void * key_ptr, int key_len, void * val_ptr, int val_len,
+    MU32 last_access, MU32 expire_time, MU32 flags) {
+  HV * ih = newHV();
+  SV * key, * val;
+
+  key = newSVpvn((const char *)key_ptr, key_len);
+  if (flags & FC_UTF8KEY) {
+    SvUTF8_on(key);
+  }
+
+  val = fc_value_sv(aTHX_ val_ptr, val_len, flags);
+  flags = flags & ~FC_SVFLAGS;
+
+  /* Store in hash ref */
+  hv_store(ih, "key", 3, key, 0); 
+  hv_store(ih, "value", 5, val, 0);
+  hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
+  hv_store(ih, "expire_time", 11, newSViv((IV)expire_time), 0);
+  hv_store(ih, "flags", 5, newSViv((IV)flags), 0); 
+
+  return newRV_noinc((SV *)ih);
+}
+
+/* Hash the tag names in the array ref tags for the tag index, into
+ * *tag_hashes, which is freed when the current scope is left.
+ * Returns the number of tags, 0 if none or the cache has no tag
+ * index */
+static int fc_tag_hashes(pTHX_ mmap_cache * cache, SV * tags, MU32 ** tag_hashes) {
+  AV * tags_av;
+  int n_tags, i;
+
+  if (!tags || !SvROK(tags) || SvTYPE(SvRV(tags)) != SVt_PVAV)
+    return 0;
+  if (!mmc_get_param(cache, "tag_slots"))
+    return 0;
+
+  tags_av = (AV *)SvRV(tags);
+  n_tags = av_len(tags_av) + 1;
+  if (n_tags <= 0)
+    return 0;
+
+  Newx(*tag_hashes, n_tags, MU32);
+  SAVEFREEPV(*tag_hashes);
+
+  for (i = 0; i < n_tags; i++) {
+    SV ** tag = av_fetch(tags_av, i, 0);
+    STRLEN tag_len = 0;
+    char * tag_ptr = tag ? SvPV(*tag, tag_len) : "";
+    (*tag_hashes)[i] = mmc_tag_hash(tag_ptr, (int)tag_len);
+  }
+
+  return n_tags;
+}
+
+/* Write an item to the currently locked page, referencing it from
+ * the page's tag index for each of n_tags tag hashes. An item that
+ * can't be found by its tags mustn't stay cached, so is deleted if
+ * the index is full. Returns whether the item was stored */
+static int fc_write_tagged(
+  mmap_cache * cache, MU32 hash_slot,
+  void * key_ptr, int key_len, void * val_ptr, int val_len,
+  MU32 expire_seconds, MU32 soft_seconds, MU32 recompute_ms,
+  MU32 flags, MU32 * tag_hashes, int n_tags
+) {
+  int did_store;
+
+  if (n_tags)
+    flags |= MMC_TAGGED;
+
+  did_store = mmc_write_ext(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_seconds, soft_seconds, recompute_ms, flags);
+
+  if (did_store && n_tags && mmc_tag_add(cache, hash_slot, tag_hashes, n_tags) != 0) {
+    MU32 del_flags;
+    mmc_delete(cache, hash_slot, key_ptr, key_len, &del_flags);
+    did_store = 0;
+  }
+
+  return did_store;
+}
+
+/* Create a new SV with the details of the entry in the currently
+ * locked page, as returned by get_keys(). Mode 0 is just the key,
+ * mode 1 is a hash ref of details, and mode 2 adds the value */
+static SV * fc_details_sv(pTHX_ mmap_cache * cache, MU32 * entry_ptr, int mode) {
+  void * key_ptr, * val_ptr;
+  int key_len, val_len;
+  MU32 last_access, expire_time, flags;
+  HV * ih;
+  SV * key;
+
+  mmc_get_details(cache, entry_ptr,
+    &key_ptr, &key_len, &val_ptr, &val_len,
+    &last_access, &expire_time, &flags);
+
+  /* Create key SV, and set UTF8'ness if needed */
+  key = newSVpvn((const char *)key_ptr, key_len);
+  if (flags & FC_UTF8KEY) {
+    SvUTF8_on(key);
+    flags ^= FC_UTF8KEY;
+  }
+
+  /* Mode 0 is just the key */
+  if (mode == 0)
+    return key;
+
+  /* Mode 1/2 is a hash-ref */
+  ih = newHV();
+
+  /* These things by default */
+  hv_store(ih, "key", 3, key, 0); 
+  hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
+  hv_store(ih, "expire_time", 11, newSViv((IV)expire_time), 0);
+  hv_store(ih, "flags", 5, newSViv((IV)flags), 0); 
+
+  /* Add value to hash-ref if mode 2 */
+  if (mode == 2) {
+    hv_store(ih, "value", 5, fc_value_sv(aTHX_ val_ptr, val_len, flags), 0);
+  }
+
+  /* Create reference to hash */
+  return newRV_noinc((SV *)ih);
+}
+
+/* Expunge entries from the currently locked page to make space
+ * for n_items entries with len bytes of key/value data in total.
+ * If wb_items is passed, a hash ref with the details of each
+ * expunged entry is pushed onto it so it can be written back */
+static void fc_do_expunge(pTHX_ mmap_cache * cache, int mode, int n_items, int len, AV * wb_items) {
+  MU32 new_num_slots = 0, ** to_expunge = 0;
+  int num_expunge, item;
+
+  void * key_ptr, * val_ptr;
+  int key_len, val_len;
+  MU32 last_access, expire_time, flags;
+
+  num_expunge = mmc_calc_expunge_many(cache, mode, n_items, len, &new_num_slots, &to_expunge);
+  if (!to_expunge)
+    return;
+
+  /* Want list of expunged keys/values? */
+  if (wb_items) {
+
+    /* Dirty items pushed out to make space go on the write behind
+     *  queue if there's one, rather than being written back now */
+    int queue = mode == 2 && mmc_queue_lock(cache) == 0;
+
+    for (item = 0; item < num_expunge; item++) {
+      mmc_get_details(cache, to_expunge[item],
+        &key_ptr, &key_len, &val_ptr, &val_len,
+        &last_access, &expire_time, &flags);
+
+      if (queue && (flags & MMC_DIRTY) &&
+          mmc_queue_push(cache, key_ptr, key_len, val_ptr, val_len, expire_time, flags))
+        continue;
+
+      av_push(wb_items, fc_item_rv(aTHX_ key_ptr, key_len, val_ptr, val_len, last_access, expire_time, flags));
+    }
+
+    if (queue)
+      mmc_queue_unlock(cache);
+  }
+
+  mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge);
+}
+
+/* mmc_read_stream() callback, writes value data to the file
+ * descriptor passed in ctx. Returns bytes written or -2 on error */
+static int fc_write_fd(void * ctx, void * val_ptr, int val_len, MU32 flags) {
+  dTHX;
+  int fd = *(int *)ctx;
+  char * ptr = (char *)val_ptr;
+  int left = val_len;
+
+  /* Write native numbers out as the string get() would return */
+  if (flags & FC_NUMVAL) {
+    SV * num = sv_2mortal(newSV(0));
+    STRLEN pl_num_len;
+
+    fc_num_setsv(aTHX_ num, val_ptr, flags);
+    ptr = SvPV(num, pl_num_len);
+    val_len = left = (int)pl_num_len;
+  }
+
+  while (left > 0) {
+    int written = PerlLIO_write(fd, ptr, left);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -2;
+    }
+    ptr += written;
+    left -= written;
+  }
+
+  return val_len;
+}
+
+/* Single key of a batch call. Items are sorted by page so that
+ * each page only needs to be locked once for the whole batch */
+typedef struct {
+  SV *  key;
+  void * key_ptr;
+  int   key_len;
+  MU32  hash_page;
+  MU32  hash_slot;
+  int   index;
+} fc_batch_item;
+
+static int fc_batch_cmp(const void * a, const void * b) {
+  const fc_batch_item * ai = (const fc_batch_item *)a;
+  const fc_batch_item * bi = (const fc_batch_item *)b;
+  if (ai->hash_page < bi->hash_page) return -1;
+  if (ai->hash_page > bi->hash_page) return 1;
+  return ai->index - bi->index;
+}
+
+/* Hash every key in the passed array ref and return list sorted
+ * by page. Memory is freed automatically when the XSUB exits */
+static fc_batch_item * fc_batch_new(pTHX_ mmap_cache * cache, SV * keys_ref, int * n_items) {
+  AV * keys;
+  fc_batch_item * items;
+  int i, n;
+
+  if (!SvROK(keys_ref) || SvTYPE(SvRV(keys_ref)) != SVt_PVAV)
+    croak("Keys not an array reference");
+  keys = (AV *)SvRV(keys_ref);
+
+  n = av_len(keys) + 1;
+  Newxz(items, n + 1, fc_batch_item);
+  SAVEFREEPV(items);
+
+  for (i = 0; i < n; i++) {
+    SV ** key_svp = av_fetch(keys, i, 0);
+    SV * key = key_svp ? *key_svp : &PL_sv_undef;
+    STRLEN pl_key_len;
+
+    items[i].key = key;
+    items[i].key_ptr = (void *)SvPV(key, pl_key_len);
+    items[i].key_len = (int)pl_key_len;
+    items[i].index = i;
+    mmc_hash(cache, items[i].key_ptr, items[i].key_len, &items[i].hash_page, &items[i].hash_slot);
+  }
+
+  qsort(items, n, sizeof(fc_batch_item), fc_batch_cmp);
+
+  *n_items = n;
+  return items;
+}
+
 
 MODULE = Cache::FastMmap		PACKAGE = Cache::FastMmap
 PROTOTYPES: ENABLE
@@ -177,93 +586,142 @@ fc_read(obj, hash_slot, key)
 
     /* Get value data pointer */
     found = mmc_read(cache, (MU32)hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags);
+    val = fc_read_sv(aTHX_ found, val_ptr, val_len, &flags);
 
-    /* If not found, use undef */
-    if (found == -1) {
-      val = &PL_sv_undef;
-    } else {
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)!found)));
+
+
+void
+fc_read_view(obj, hash_slot, key, val)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+    SV * val;
+  INIT:
+    int key_len, val_len, found;
+    void * key_ptr, * val_ptr;
+    MU32 flags = 0;
+    STRLEN pl_key_len;
 
-      /* Cached an undef value? */
-      if (flags & FC_UNDEF) {
-        val = &PL_sv_undef;
+    FC_ENTRY
 
-      } else {
+  PPCODE:
 
-        /* Create PERL SV */
-        val = sv_2mortal(newSVpvn((const char *)val_ptr, val_len));
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
 
-        /* Make UTF8 if stored from UTF8 */
-        if (flags & FC_UTF8VAL) {
-          SvUTF8_on(val);
-        }
+    /* Get value data pointer */
+    found = mmc_read(cache, (MU32)hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags);
 
+    /* Make the passed SV a read only view pointing straight at the
+     * value data in the page. Only valid until fc_release_view() is
+     * called, which must be done before the page is unlocked */
+    sv_setsv(val, &PL_sv_undef);
+    if (found != -1 && (flags & FC_NUMVAL)) {
+      fc_num_setsv(aTHX_ val, val_ptr, flags);
+      SvREADONLY_on(val);
+    } else if (found != -1 && !(flags & FC_UNDEF)) {
+      SvUPGRADE(val, SVt_PV);
+      SvPV_free(val);
+      SvPV_set(val, (char *)val_ptr);
+      SvCUR_set(val, val_len);
+      SvLEN_set(val, 0);
+      SvPOK_only(val);
+      if (flags & FC_UTF8VAL) {
+        SvUTF8_on(val);
       }
-      flags = flags & ~(FC_UTF8KEY | FC_UTF8VAL | FC_UNDEF);
+      SvREADONLY_on(val);
+    }
+    if (found != -1) {
+      flags = flags & ~FC_SVFLAGS;
     }
 
-    XPUSHs(val);
     XPUSHs(sv_2mortal(newSViv((IV)flags)));
     XPUSHs(sv_2mortal(newSViv((IV)!found)));
 
 
-int
-fc_write(obj, hash_slot, key, val, expire_seconds, in_flags)
+void
+fc_release_view(val)
+    SV * val;
+  CODE:
+    /* Detach a view created by fc_read_view() from the page data */
+    if (SvPOK(val) && SvLEN(val) == 0) {
+      SvREADONLY_off(val);
+      SvPV_set(val, NULL);
+      SvCUR_set(val, 0);
+      SvOK_off(val);
+    }
+
+
+void
+fc_get_into(obj, key, buf)
     SV * obj;
-    U32  hash_slot;
     SV * key;
-    SV * val;
-    U32 expire_seconds;
-    U32 in_flags;
+    SV * buf;
   INIT:
-    int key_len, val_len;
+    int key_len, val_len, found;
     void * key_ptr, * val_ptr;
-    STRLEN pl_key_len, pl_val_len;
+    MU32 hash_page, hash_slot, flags = 0;
+    STRLEN pl_key_len;
 
     FC_ENTRY
 
-  CODE:
+  PPCODE:
 
     /* Get key length, data pointer */
     key_ptr = (void *)SvPV(key, pl_key_len);
     key_len = (int)pl_key_len;
 
-    /* Check for storing undef, and store empty string with undef flag set */
-    if (!SvOK(val)) {
-      in_flags |= FC_UNDEF;
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
 
-      val_ptr = "";
-      val_len = 0;
+    /* Get and lock the page, if the key might be there */
+    found = -1;
+    if (mmc_bloom_check(cache, hash_page, hash_slot)) {
+      if (mmc_lock(cache, hash_page) != 0)
+        croak("%s", mmc_error(cache));
+      found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags);
+    }
 
+    /* Copy value into existing buffer of passed SV, only growing
+     * it if it's too small. Undef keeps the buffer for next time */
+    if (found == -1 || (flags & FC_UNDEF)) {
+      SvOK_off(buf);
+    } else if (flags & FC_NUMVAL) {
+      fc_num_setsv(aTHX_ buf, val_ptr, flags);
     } else {
+      /* sv_setpvn() keeps the UTF8 flag of the old buffer value */
+      SvUTF8_off(buf);
+      sv_setpvn(buf, (const char *)val_ptr, val_len);
+      if (flags & FC_UTF8VAL) {
+        SvUTF8_on(buf);
+      }
+    }
 
-      /* Get key length, data pointer */
-      val_ptr = (void *)SvPV(val, pl_val_len);
-      val_len = (int)pl_val_len;
+    if (mmc_is_locked(cache))
+      mmc_unlock(cache);
 
-      /* Set UTF8-ness flag of stored value */
-      if (SvUTF8(val)) {
-        in_flags |= FC_UTF8VAL;
-      }
-      if (SvUTF8(key)) {
-        in_flags |= FC_UTF8KEY;
-      }
+    SvSETMAGIC(buf);
+
+    if (found != -1) {
+      flags = flags & ~FC_SVFLAGS;
     }
 
-    /* Write value to cache */
-    RETVAL = mmc_write(cache, (MU32)hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_seconds, (MU32)in_flags);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)!found)));
 
-  OUTPUT:
-    RETVAL
 
-int
-fc_delete(obj, hash_slot, key)
+void
+fc_exists(obj, key)
     SV * obj;
-    U32  hash_slot;
     SV * key;
   INIT:
-    MU32 out_flags;
-    int key_len, did_delete;
+    int key_len, val_len = 0, found;
     void * key_ptr;
+    MU32 hash_page, hash_slot, expire_time = 0;
     STRLEN pl_key_len;
 
     FC_ENTRY
@@ -274,193 +732,239 @@ fc_delete(obj, hash_slot, key)
     key_ptr = (void *)SvPV(key, pl_key_len);
     key_len = (int)pl_key_len;
 
-    /* Write value to cache */
-    did_delete = mmc_delete(cache, (MU32)hash_slot, key_ptr, key_len, &out_flags);
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
 
-    XPUSHs(sv_2mortal(newSViv((IV)did_delete)));
-    XPUSHs(sv_2mortal(newSViv((IV)out_flags)));
+    /* Only lock and check the page if the key might be there */
+    found = 0;
+    if (mmc_bloom_check(cache, hash_page, hash_slot)) {
+      if (mmc_lock(cache, hash_page) != 0)
+        croak("%s", mmc_error(cache));
+
+      found = mmc_exists(cache, hash_slot, key_ptr, key_len, &expire_time, &val_len);
+
+      mmc_unlock(cache);
+    }
+
+    XPUSHs(sv_2mortal(newSViv((IV)found)));
+    XPUSHs(sv_2mortal(newSViv((IV)expire_time)));
+    XPUSHs(sv_2mortal(newSViv((IV)val_len)));
 
 
 void
-fc_get_page_details(obj)
+fc_exists_many(obj, keys)
     SV * obj;
+    SV * keys;
   INIT:
-    MU32 nreads = 0, nreadhits = 0;
+    fc_batch_item * items;
+    SV ** out;
+    int n_items, i, val_len, found;
+    MU32 locked_page = (MU32)-1, expire_time;
 
     FC_ENTRY
 
   PPCODE:
-    mmc_get_page_details(cache, &nreads, &nreadhits);
 
-    XPUSHs(sv_2mortal(newSViv((IV)nreads)));
-    XPUSHs(sv_2mortal(newSViv((IV)nreadhits)));
+    /* Hash all keys, sorted by page */
+    items = fc_batch_new(aTHX_ cache, keys, &n_items);
 
+    /* Found/expire time/length for each key, in the original order */
+    Newxz(out, n_items * 3 + 1, SV *);
+    SAVEFREEPV(out);
 
-NO_OUTPUT void
-fc_reset_page_details(obj)
+    for (i = 0; i < n_items; i++) {
+      fc_batch_item * item = items + i;
+
+      expire_time = 0;
+      val_len = 0;
+
+      /* Skip keys that are definitely not in their page */
+      if (item->hash_page != locked_page && !mmc_bloom_check(cache, item->hash_page, item->hash_slot)) {
+        out[item->index * 3] = sv_2mortal(newSViv(0));
+        out[item->index * 3 + 1] = sv_2mortal(newSViv(0));
+        out[item->index * 3 + 2] = sv_2mortal(newSViv(0));
+        continue;
+      }
+
+      /* Lock each page only once */
+      if (item->hash_page != locked_page) {
+        if (locked_page != (MU32)-1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, item->hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        locked_page = item->hash_page;
+      }
+
+      found = mmc_exists(cache, item->hash_slot, item->key_ptr, item->key_len, &expire_time, &val_len);
+
+      out[item->index * 3] = sv_2mortal(newSViv((IV)found));
+      out[item->index * 3 + 1] = sv_2mortal(newSViv((IV)expire_time));
+      out[item->index * 3 + 2] = sv_2mortal(newSViv((IV)val_len));
+    }
+
+    if (locked_page != (MU32)-1)
+      mmc_unlock(cache);
+
+    EXTEND(SP, n_items * 3);
+    for (i = 0; i < n_items * 3; i++) {
+      PUSHs(out[i]);
+    }
+
+
+int
+fc_touch(obj, key, expire_seconds)
     SV * obj;
+    SV * key;
+    U32 expire_seconds;
   INIT:
-    MU32 nreads = 0, nreadhits = 0;
+    int key_len;
+    void * key_ptr;
+    MU32 hash_page, hash_slot;
+    STRLEN pl_key_len;
 
     FC_ENTRY
 
   CODE:
-    mmc_reset_page_details(cache);
 
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    RETVAL = mmc_touch(cache, hash_slot, key_ptr, key_len, (MU32)expire_seconds);
+
+    mmc_unlock(cache);
+
+  OUTPUT:
+    RETVAL
 
 
 void
-fc_expunge(obj, mode, wb, len)
+fc_touch_many(obj, keys, expire_seconds)
     SV * obj;
-    int mode;
-    int wb;
-    int len;
+    SV * keys;
+    U32 expire_seconds;
   INIT:
-    MU32 new_num_slots = 0, ** to_expunge = 0;
-    int num_expunge, item;
-
-    void * key_ptr, * val_ptr;
-    int key_len, val_len;
-    MU32 last_access, expire_time, flags;
+    fc_batch_item * items;
+    SV ** out;
+    int n_items, i;
+    MU32 locked_page = (MU32)-1;
 
     FC_ENTRY
 
   PPCODE:
 
-    num_expunge = mmc_calc_expunge(cache, mode, len, &new_num_slots, &to_expunge);
-    if (to_expunge) {
-
-      /* Want list of expunged keys/values? */
-      if (wb) {
-
-        for (item = 0; item < num_expunge; item++) {
-          mmc_get_details(cache, to_expunge[item],
-            &key_ptr, &key_len, &val_ptr, &val_len,
-            &last_access, &expire_time, &flags);
-
-          {
-          HV * ih = (HV *)sv_2mortal((SV *)newHV());
-
-          SV * key = newSVpvn((const char *)key_ptr, key_len);
-          SV * val;
-
-          if (flags & FC_UTF8KEY) {
-            SvUTF8_on(key);
-            flags ^= FC_UTF8KEY;
-          }
-
-          if (flags & FC_UNDEF) {
-            val = newSV(0);
-            flags ^= FC_UNDEF;
-          } else {
-            val = newSVpvn((const char *)val_ptr, val_len);
-            if (flags & FC_UTF8VAL) {
-              SvUTF8_on(val);
-              flags ^= FC_UTF8VAL;
-            }
-          }
-
-          /* Store in hash ref */
-          hv_store(ih, "key", 3, key, 0); 
-          hv_store(ih, "value", 5, val, 0);
-          hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
-          hv_store(ih, "expire_time", 11, newSViv((IV)expire_time), 0);
-          hv_store(ih, "flags", 5, newSViv((IV)flags), 0); 
-
-          /* Create reference to hash */
-          XPUSHs(sv_2mortal(newRV((SV *)ih)));
-          }
-        }
+    /* Hash all keys, sorted by page */
+    items = fc_batch_new(aTHX_ cache, keys, &n_items);
+
+    /* Whether each key was touched, in the original order */
+    Newxz(out, n_items + 1, SV *);
+    SAVEFREEPV(out);
+
+    for (i = 0; i < n_items; i++) {
+      fc_batch_item * item = items + i;
+
+      /* Lock each page only once */
+      if (item->hash_page != locked_page) {
+        if (locked_page != (MU32)-1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, item->hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        locked_page = item->hash_page;
       }
 
-      mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge);
+      out[item->index] = sv_2mortal(newSViv((IV)mmc_touch(cache,
+          item->hash_slot, item->key_ptr, item->key_len, (MU32)expire_seconds)));
     }
 
+    if (locked_page != (MU32)-1)
+      mmc_unlock(cache);
 
+    EXTEND(SP, n_items);
+    for (i = 0; i < n_items; i++) {
+      PUSHs(out[i]);
+    }
 
 
 void
-fc_get_keys(obj, mode)
+fc_get_range(obj, key, offset, len)
     SV * obj;
-    int mode;
+    SV * key;
+    int offset;
+    int len;
   INIT:
-    mmap_cache_it * it;
-    MU32 * entry_ptr;
-    void * key_ptr, * val_ptr;
-    int key_len, val_len;
-    MU32 last_access, expire_time, flags;
+    int key_len, val_len = 0, range_len;
+    void * key_ptr, * range_ptr;
+    MU32 hash_page, hash_slot, flags = 0;
+    STRLEN pl_key_len;
+    SV * val = &PL_sv_undef;
 
     FC_ENTRY
 
   PPCODE:
 
-    it = mmc_iterate_new(cache);
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
 
-    /* Iterate over all items */
-    while (entry_ptr = mmc_iterate_next(it)) {
-      SV *  key;
-      mmc_get_details(cache, entry_ptr,
-        &key_ptr, &key_len, &val_ptr, &val_len,
-        &last_access, &expire_time, &flags);
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
 
-      /* Create key SV, and set UTF8'ness if needed */
-      key = newSVpvn((const char *)key_ptr, key_len);
-      if (flags & FC_UTF8KEY) {
-        SvUTF8_on(key);
-        flags ^= FC_UTF8KEY;
-      }
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
 
-      /* Mode 0 is just list of keys */
-      if (mode == 0) {
-        XPUSHs(sv_2mortal(key));
-
-      /* Mode 1/2 is list of hash-refs */
-      } else if (mode == 1 || mode == 2) {
-        HV * ih = (HV *)sv_2mortal((SV *)newHV());
-
-        /* These things by default */
-        hv_store(ih, "key", 3, key, 0); 
-        hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
-        hv_store(ih, "expire_time", 11, newSViv((IV)expire_time), 0);
-        hv_store(ih, "flags", 5, newSViv((IV)flags), 0); 
-
-        /* Add value to hash-ref if mode 2 */
-        if (mode == 2) {
-          SV * val;
-          if (flags & FC_UNDEF) {
-            val = newSV(0);
-            flags ^= FC_UNDEF;
-          } else {
-            val = newSVpvn((const char *)val_ptr, val_len);
-            if (flags & FC_UTF8VAL) {
-              SvUTF8_on(val);
-              flags ^= FC_UTF8VAL;
-            }
-          }
-          hv_store(ih, "value", 5, val, 0);
-        }
+    /* Only copy the requested part of the value */
+    range_len = mmc_read_range(cache, hash_slot, key_ptr, key_len, offset, len, &range_ptr, &val_len, &flags);
+    if (range_len != -1 && (flags & FC_NUMVAL)) {
+      /* Native numbers are stored as binary, so take the range of
+       *  the decimal string that get() would return instead */
+      int num_offset = offset;
+      STRLEN pl_val_len;
+      SV * num;
+      char * num_ptr;
+
+      /* range_ptr is at the clipped offset into the binary value */
+      mmc_clip_range(val_len, &num_offset, -1);
+      num = sv_2mortal(fc_value_sv(aTHX_ (char *)range_ptr - num_offset, val_len, flags));
+      num_ptr = SvPV(num, pl_val_len);
 
-        /* Create reference to hash */
-        XPUSHs(sv_2mortal(newRV((SV *)ih)));
-      }
-    }
+      val_len = (int)pl_val_len;
+      range_len = mmc_clip_range(val_len, &offset, len);
+      val = sv_2mortal(newSVpvn(num_ptr + offset, range_len));
 
-    mmc_iterate_close(it);
+    } else if (range_len != -1 && !(flags & FC_UNDEF)) {
+      val = sv_2mortal(newSVpvn((const char *)range_ptr, range_len));
+    }
 
+    mmc_unlock(cache);
 
+    if (range_len != -1) {
+      flags = flags & ~FC_SVFLAGS;
+    }
 
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)(range_len != -1))));
+    XPUSHs(sv_2mortal(newSViv((IV)val_len)));
 
 
-SV *
-fc_get(obj, key)
+int
+fc_read_fd(obj, key, fd)
     SV * obj;
     SV * key;
+    int fd;
   INIT:
-    int key_len, val_len, found;
-    void * key_ptr, * val_ptr;
-    MU32 hash_page, hash_slot, flags;
+    int key_len;
+    void * key_ptr;
+    MU32 hash_page, hash_slot;
     STRLEN pl_key_len;
-    SV * val;
 
     FC_ENTRY
 
@@ -474,36 +978,35 @@ fc_get(obj, key)
     mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
 
     /* Get and lock the page */
-    mmc_lock(cache, hash_page);
-
-    /* Get value data pointer */
-    found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags);
-
-    /* If not found, use undef */
-    if (found == -1) {
-      val = &PL_sv_undef;
-    } else {
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
 
-      /* Create PERL SV */
-      val = newSVpvn((const char *)val_ptr, val_len);
-    }
+    /* Write value data straight from the page to the file descriptor */
+    RETVAL = mmc_read_stream(cache, hash_slot, key_ptr, key_len, fc_write_fd, (void *)&fd);
 
     mmc_unlock(cache);
-    RETVAL = val;
+
   OUTPUT:
     RETVAL
 
 
-void
-fc_set(obj, key, val)
+int
+fc_write(obj, hash_slot, key, val, expire_seconds, in_flags, soft_seconds = (U32)-1, recompute_ms = 0, tags = 0)
     SV * obj;
+    U32  hash_slot;
     SV * key;
     SV * val;
+    U32 expire_seconds;
+    U32 in_flags;
+    U32 soft_seconds;
+    U32 recompute_ms;
+    SV * tags;
   INIT:
-    int key_len, val_len, found;
+    int key_len, val_len, n_tags;
     void * key_ptr, * val_ptr;
-    MU32 hash_page, hash_slot, flags = 0;
-    STRLEN pl_key_len, pl_val_len;
+    MU32 * tag_hashes = 0;
+    STRLEN pl_key_len;
+    fc_num num;
 
     FC_ENTRY
 
@@ -513,20 +1016,1005 @@ fc_set(obj, key, val)
     key_ptr = (void *)SvPV(key, pl_key_len);
     key_len = (int)pl_key_len;
 
-    /* Get key length, data pointer */
-    val_ptr = (void *)SvPV(val, pl_val_len);
-    val_len = (int)pl_val_len;
-
-    /* Hash key to get page and slot */
-    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+    /* Get value data pointer and flags */
+    fc_write_sv(aTHX_ key, val, &val_ptr, &val_len, (MU32 *)&in_flags, &num);
 
-    /* Get and lock the page */
-    mmc_lock(cache, hash_page);
+    /* Write value to cache */
+    n_tags = fc_tag_hashes(aTHX_ cache, tags, &tag_hashes);
+    RETVAL = fc_write_tagged(cache, (MU32)hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_seconds, (MU32)soft_seconds, (MU32)recompute_ms, in_flags, tag_hashes, n_tags);
 
-    /* Get value data pointer */
-    mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, -1, flags);
+  OUTPUT:
+    RETVAL
 
-    mmc_unlock(cache);
+int
+fc_lease(obj, hash_slot, key, lease_seconds)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+    U32 lease_seconds;
+  INIT:
+    int key_len;
+    void * key_ptr;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+  CODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    RETVAL = mmc_lease(cache, (MU32)hash_slot, key_ptr, key_len, (MU32)lease_seconds);
+
+  OUTPUT:
+    RETVAL
+
+int
+fc_lease_release(obj, hash_slot, key)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+  INIT:
+    int key_len;
+    void * key_ptr;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+  CODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    RETVAL = mmc_lease_release(cache, (MU32)hash_slot, key_ptr, key_len);
+
+  OUTPUT:
+    RETVAL
+
+int
+fc_refresh(obj, hash_slot, key, lease_seconds)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+    U32 lease_seconds;
+  INIT:
+    int key_len;
+    void * key_ptr;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+  CODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    RETVAL = mmc_refresh(cache, (MU32)hash_slot, key_ptr, key_len, (MU32)lease_seconds);
+
+  OUTPUT:
+    RETVAL
+
+int
+fc_delete(obj, hash_slot, key)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+  INIT:
+    MU32 out_flags;
+    int key_len, did_delete;
+    void * key_ptr;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Delete from the page, and any older values waiting in the
+     *  write behind queue, so they're not found or written back */
+    did_delete = mmc_delete(cache, (MU32)hash_slot, key_ptr, key_len, &out_flags);
+    mmc_queue_remove(cache, MMC_QUEUE_KEY, key_ptr, key_len, 0, 0, (MU32)mmc_get_param(cache, "num_pages"));
+
+    XPUSHs(sv_2mortal(newSViv((IV)did_delete)));
+    XPUSHs(sv_2mortal(newSViv((IV)out_flags)));
+
+
+void
+fc_get_page_details(obj)
+    SV * obj;
+  INIT:
+    MU32 nreads = 0, nreadhits = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+    mmc_get_page_details(cache, &nreads, &nreadhits);
+
+    XPUSHs(sv_2mortal(newSViv((IV)nreads)));
+    XPUSHs(sv_2mortal(newSViv((IV)nreadhits)));
+
+
+NO_OUTPUT void
+fc_reset_page_details(obj)
+    SV * obj;
+  INIT:
+    MU32 nreads = 0, nreadhits = 0;
+
+    FC_ENTRY
+
+  CODE:
+    mmc_reset_page_details(cache);
+
+
+
+void
+fc_expunge(obj, mode, wb, len)
+    SV * obj;
+    int mode;
+    int wb;
+    int len;
+  INIT:
+    AV * wb_items = 0;
+    int item;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    fc_do_expunge(aTHX_ cache, mode, 1, len, wb_items);
+
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
+
+
+
+
+void
+fc_queue_pop(obj, max_items)
+    SV * obj;
+    int max_items;
+  INIT:
+    void * key_ptr, * val_ptr;
+    int key_len, val_len, n_items = 0;
+    MU32 expire_time, flags;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    if (mmc_queue_lock(cache) != 0)
+      XSRETURN_EMPTY;
+
+    while (n_items++ < max_items &&
+        mmc_queue_pop(cache, &key_ptr, &key_len, &val_ptr, &val_len, &expire_time, &flags)) {
+      XPUSHs(sv_2mortal(fc_item_rv(aTHX_ key_ptr, key_len, val_ptr, val_len, 0, expire_time, flags)));
+    }
+
+    mmc_queue_unlock(cache);
+
+
+void
+fc_queue_clear(obj, first_page, end_page)
+    SV * obj;
+    U32 first_page;
+    U32 end_page;
+  INIT:
+    FC_ENTRY
+
+  CODE:
+    mmc_queue_remove(cache, MMC_QUEUE_ALL, 0, 0, 0, (MU32)first_page, (MU32)end_page);
+
+
+void
+fc_queue_get(obj, keys_ref)
+    SV * obj;
+    SV * keys_ref;
+  INIT:
+    AV * keys;
+    void * key_ptr, * val_ptr;
+    int key_len, val_len, found, i, n_keys, maybe = 0;
+    MU32 expire_time, flags;
+    STRLEN pl_key_len;
+    SV * val;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Value, flags and found for each key, from the newest item
+     * for it in the queue */
+    if (!SvROK(keys_ref) || SvTYPE(SvRV(keys_ref)) != SVt_PVAV)
+      croak("Keys not an array reference");
+    keys = (AV *)SvRV(keys_ref);
+    n_keys = av_len(keys) + 1;
+
+    /* Only lock the queue if its bloom filter says any may be there */
+    for (i = 0; i < n_keys && !maybe; i++) {
+      SV ** key = av_fetch(keys, i, 0);
+      key_ptr = key ? (void *)SvPV(*key, pl_key_len) : (pl_key_len = 0, "");
+      maybe = mmc_queue_maybe(cache, key_ptr, (int)pl_key_len);
+    }
+
+    if (maybe && mmc_queue_lock(cache) != 0)
+      croak("%s", mmc_error(cache));
+
+    EXTEND(SP, n_keys * 3);
+    for (i = 0; i < n_keys; i++) {
+      SV ** key = av_fetch(keys, i, 0);
+      key_ptr = key ? (void *)SvPV(*key, pl_key_len) : (pl_key_len = 0, "");
+      key_len = (int)pl_key_len;
+
+      flags = 0;
+      found = maybe && mmc_queue_find(cache, key_ptr, key_len, &val_ptr, &val_len, &expire_time, &flags) ? 0 : -1;
+      val = fc_read_sv(aTHX_ found, val_ptr, val_len, &flags);
+
+      PUSHs(val);
+      PUSHs(sv_2mortal(newSViv((IV)flags)));
+      PUSHs(sv_2mortal(newSViv((IV)!found)));
+    }
+
+    if (maybe)
+      mmc_queue_unlock(cache);
+
+
+void
+fc_dirty_pages(obj)
+    SV * obj;
+  INIT:
+    MU32 * pages;
+    int n_pages, i;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    Newx(pages, mmc_get_param(cache, "num_pages"), MU32);
+    n_pages = mmc_dirty_pages(cache, pages);
+
+    EXTEND(SP, n_pages);
+    for (i = 0; i < n_pages; i++)
+      PUSHs(sv_2mortal(newSVuv((UV)pages[i])));
+
+    Safefree(pages);
+
+
+void
+fc_clean_page(obj, page)
+    SV * obj;
+    U32 page;
+  INIT:
+    MU32 ** dirty;
+    void * key_ptr, * val_ptr;
+    int key_len, val_len, n_items, i;
+    MU32 last_access, expire_time, flags;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    if (mmc_lock(cache, (MU32)page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Items are returned still marked dirty, as for expunged items */
+    n_items = mmc_clean_page(cache, &dirty);
+    for (i = 0; i < n_items; i++) {
+      mmc_get_details(cache, dirty[i],
+        &key_ptr, &key_len, &val_ptr, &val_len,
+        &last_access, &expire_time, &flags);
+      XPUSHs(sv_2mortal(fc_item_rv(aTHX_ key_ptr, key_len, val_ptr, val_len,
+        last_access, expire_time, flags | MMC_DIRTY)));
+    }
+    free(dirty);
+
+    mmc_unlock(cache);
+
+
+void
+fc_match(obj, pattern, delete, mode, first_page, end_page)
+    SV * obj;
+    SV * pattern;
+    int delete;
+    int mode;
+    U32 first_page;
+    U32 end_page;
+  INIT:
+    MU32 ** matches, page, num_pages;
+    void * pattern_ptr;
+    STRLEN pattern_len;
+    int n_items, i, total = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    pattern_ptr = (void *)SvPV(pattern, pattern_len);
+
+    num_pages = (MU32)mmc_get_param(cache, "num_pages");
+    if (end_page > num_pages)
+      end_page = num_pages;
+
+    /* Lock each page once, and only make SVs for matching items.
+     * A mode of -1 just returns the number of matches */
+    for (page = first_page; page < end_page; page++) {
+      if (mmc_lock(cache, page) != 0)
+        croak("%s", mmc_error(cache));
+
+      n_items = mmc_match_page(cache, pattern_ptr, (int)pattern_len, delete, &matches);
+      if (delete)
+        mmc_queue_remove(cache, MMC_QUEUE_GLOB, pattern_ptr, (int)pattern_len, 0, page, page + 1);
+      if (mode >= 0) {
+        for (i = 0; i < n_items; i++) {
+          XPUSHs(sv_2mortal(fc_details_sv(aTHX_ cache, matches[i], mode)));
+        }
+      }
+      total += n_items;
+      free(matches);
+
+      mmc_unlock(cache);
+    }
+
+    if (mode < 0) {
+      XPUSHs(sv_2mortal(newSViv((IV)total)));
+    }
+
+
+void
+fc_tag_invalidate(obj, tag, mode)
+    SV * obj;
+    SV * tag;
+    int mode;
+  INIT:
+    MU32 ** removed, page, num_pages, tag_hash;
+    void * tag_ptr;
+    STRLEN tag_len;
+    int n_items, i, total = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    tag_ptr = (void *)SvPV(tag, tag_len);
+    tag_hash = mmc_tag_hash(tag_ptr, (int)tag_len);
+
+    /* Only lock pages whose tag index references the tag. A mode
+     * of -1 just returns the number of items removed */
+    num_pages = (MU32)mmc_get_param(cache, "num_pages");
+    for (page = 0; page < num_pages; page++) {
+      if (!mmc_tag_in_page(cache, page, tag_hash))
+        continue;
+
+      if (mmc_lock(cache, page) != 0)
+        croak("%s", mmc_error(cache));
+
+      n_items = mmc_tag_remove_page(cache, tag_hash, &removed);
+      if (mode >= 0) {
+        for (i = 0; i < n_items; i++) {
+          XPUSHs(sv_2mortal(fc_details_sv(aTHX_ cache, removed[i], mode)));
+        }
+      }
+      total += n_items;
+      free(removed);
+
+      mmc_unlock(cache);
+    }
+
+    /* Tagged items waiting in the write behind queue too */
+    mmc_queue_remove(cache, MMC_QUEUE_TAG, 0, 0, tag_hash, 0, num_pages);
+
+    if (mode < 0) {
+      XPUSHs(sv_2mortal(newSViv((IV)total)));
+    }
+
+
+UV
+fc_ns_flags(obj, name)
+    SV * obj;
+    SV * name;
+  INIT:
+    void * name_ptr;
+    STRLEN name_len;
+
+    FC_ENTRY
+
+  CODE:
+    name_ptr = (void *)SvPV(name, name_len);
+    RETVAL = (UV)mmc_ns_flags(cache, name_ptr, (int)name_len);
+
+  OUTPUT:
+    RETVAL
+
+
+UV
+fc_ns_bump(obj, ns_flags)
+    SV * obj;
+    UV ns_flags;
+  INIT:
+    FC_ENTRY
+
+  CODE:
+    RETVAL = (UV)mmc_ns_bump(cache, (MU32)ns_flags);
+
+  OUTPUT:
+    RETVAL
+
+
+int
+fc_queue_count(obj)
+    SV * obj;
+  INIT:
+    FC_ENTRY
+
+  CODE:
+    RETVAL = mmc_queue_count(cache);
+
+  OUTPUT:
+    RETVAL
+
+
+void
+fc_get_keys(obj, mode)
+    SV * obj;
+    int mode;
+  INIT:
+    mmap_cache_it * it;
+    MU32 * entry_ptr;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    it = mmc_iterate_new(cache);
+
+    /* Iterate over all items */
+    while (entry_ptr = mmc_iterate_next(it)) {
+      XPUSHs(sv_2mortal(fc_details_sv(aTHX_ cache, entry_ptr, mode)));
+    }
+
+    mmc_iterate_close(it);
+
+
+void
+fc_iterate(obj, page, slot, end_page, max_items, mode, prefix, skip_expired)
+    SV * obj;
+    U32 page;
+    U32 slot;
+    U32 end_page;
+    int max_items;
+    int mode;
+    SV * prefix;
+    int skip_expired;
+  INIT:
+    mmap_cache_it * it;
+    MU32 * entry_ptr, num_pages, now = (MU32)time(0);
+    void * key_ptr, * val_ptr, * prefix_ptr = 0;
+    int key_len, val_len;
+    MU32 last_access, expire_time, flags;
+    STRLEN prefix_len = 0;
+    int n_items = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    if (SvOK(prefix))
+      prefix_ptr = (void *)SvPV(prefix, prefix_len);
+
+    /* Already at the end? */
+    num_pages = (MU32)mmc_get_param(cache, "num_pages");
+    if (end_page > num_pages)
+      end_page = num_pages;
+    if (page >= end_page) {
+      XPUSHs(sv_2mortal(newSVuv((UV)end_page)));
+      XPUSHs(sv_2mortal(newSVuv(0)));
+      XSRETURN(2);
+    }
+
+    /* Leave room for the position at the start */
+    EXTEND(SP, 2);
+    PUSHs(&PL_sv_undef);
+    PUSHs(&PL_sv_undef);
+
+    /* Carry on from the given position, only making SVs for the
+     * items that match, until there are enough of them. Each page
+     * is only locked while its items are looked at */
+    it = mmc_iterate_new_at(cache, (MU32)page, (MU32)slot, (MU32)end_page);
+    while (n_items < max_items && (entry_ptr = mmc_iterate_next(it))) {
+      mmc_get_details(cache, entry_ptr,
+        &key_ptr, &key_len, &val_ptr, &val_len,
+        &last_access, &expire_time, &flags);
+
+      if (prefix_len && ((STRLEN)key_len < prefix_len
+          || memcmp(key_ptr, prefix_ptr, prefix_len) != 0))
+        continue;
+      if (skip_expired && expire_time && now > expire_time)
+        continue;
+
+      XPUSHs(sv_2mortal(fc_details_sv(aTHX_ cache, entry_ptr, mode)));
+      n_items++;
+    }
+
+    mmc_iterate_position(it, (MU32 *)&page, (MU32 *)&slot);
+    mmc_iterate_close(it);
+
+    ST(0) = sv_2mortal(newSVuv((UV)page));
+    ST(1) = sv_2mortal(newSVuv((UV)slot));
+
+
+void
+fc_get_many(obj, keys)
+    SV * obj;
+    SV * keys;
+  INIT:
+    fc_batch_item * items;
+    SV ** out;
+    int n_items, i, val_len, found;
+    MU32 locked_page = (MU32)-1, flags;
+    void * val_ptr;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Hash all keys, sorted by page */
+    items = fc_batch_new(aTHX_ cache, keys, &n_items);
+
+    /* Value/flags/found for each key, in the original order */
+    Newxz(out, n_items * 3 + 1, SV *);
+    SAVEFREEPV(out);
+
+    for (i = 0; i < n_items; i++) {
+      fc_batch_item * item = items + i;
+
+      /* Skip keys that are definitely not in their page */
+      flags = 0;
+      if (item->hash_page != locked_page && !mmc_bloom_check(cache, item->hash_page, item->hash_slot)) {
+        out[item->index * 3] = &PL_sv_undef;
+        out[item->index * 3 + 1] = sv_2mortal(newSViv(0));
+        out[item->index * 3 + 2] = sv_2mortal(newSViv(0));
+        continue;
+      }
+
+      /* Lock each page only once */
+      if (item->hash_page != locked_page) {
+        if (locked_page != (MU32)-1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, item->hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        locked_page = item->hash_page;
+      }
+
+      found = mmc_read(cache, item->hash_slot, item->key_ptr, item->key_len, &val_ptr, &val_len, &flags);
+
+      out[item->index * 3] = fc_read_sv(aTHX_ found, val_ptr, val_len, &flags);
+      out[item->index * 3 + 1] = sv_2mortal(newSViv((IV)flags));
+      out[item->index * 3 + 2] = sv_2mortal(newSViv((IV)!found));
+    }
+
+    if (locked_page != (MU32)-1)
+      mmc_unlock(cache);
+
+    EXTEND(SP, n_items * 3);
+    for (i = 0; i < n_items * 3; i++) {
+      PUSHs(out[i]);
+    }
+
+
+void
+fc_set_many(obj, keys, vals, expire_seconds, in_flags, wb, soft_seconds = (U32)-1, tags = 0)
+    SV * obj;
+    SV * keys;
+    SV * vals;
+    U32 expire_seconds;
+    U32 in_flags;
+    int wb;
+    U32 soft_seconds;
+    SV * tags;
+  INIT:
+    fc_batch_item * items;
+    AV * vals_av, * did_store, * wb_items = 0;
+    int n_items, i, j, item, n_tags;
+    MU32 * tag_hashes = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    if (!SvROK(vals) || SvTYPE(SvRV(vals)) != SVt_PVAV)
+      croak("Values not an array reference");
+    vals_av = (AV *)SvRV(vals);
+
+    /* Hash all keys, sorted by page */
+    items = fc_batch_new(aTHX_ cache, keys, &n_items);
+
+    /* All items are referenced from the tag index by the same tags */
+    n_tags = fc_tag_hashes(aTHX_ cache, tags, &tag_hashes);
+
+    /* Whether each key was stored, in the original order */
+    did_store = (AV *)sv_2mortal((SV *)newAV());
+    av_fill(did_store, n_items - 1);
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    for (i = 0; i < n_items; i = j) {
+      int page_items = 0, page_len = 0;
+
+      /* Find items for this page and the space they need */
+      for (j = i; j < n_items && items[j].hash_page == items[i].hash_page; j++) {
+        SV ** val_svp = av_fetch(vals_av, items[j].index, 0);
+        SV * val = val_svp ? *val_svp : &PL_sv_undef;
+        MU32 flags = (MU32)in_flags;
+        fc_set_many_val(aTHX_ &val, &flags);
+        page_items++;
+        page_len += items[j].key_len + fc_write_len(aTHX_ val, flags);
+      }
+
+      if (mmc_lock(cache, items[i].hash_page) != 0)
+        croak("%s", mmc_error(cache));
+
+      /* One expunge run to make space for all of them */
+      fc_do_expunge(aTHX_ cache, 2, page_items, page_len, wb_items);
+
+      /* And write them all */
+      for (item = i; item < j; item++) {
+        SV ** val_svp = av_fetch(vals_av, items[item].index, 0);
+        SV * val = val_svp ? *val_svp : &PL_sv_undef;
+        void * val_ptr;
+        int val_len, stored;
+        MU32 flags = (MU32)in_flags;
+        fc_num num;
+
+        fc_set_many_val(aTHX_ &val, &flags);
+        fc_write_sv(aTHX_ items[item].key, val, &val_ptr, &val_len, &flags, &num);
+        stored = fc_write_tagged(cache, items[item].hash_slot, items[item].key_ptr, items[item].key_len,
+            val_ptr, val_len, (MU32)expire_seconds, (MU32)soft_seconds, 0, flags, tag_hashes, n_tags);
+        av_store(did_store, items[item].index, newSViv((IV)stored));
+      }
+
+      mmc_unlock(cache);
+    }
+
+    XPUSHs(sv_2mortal(newRV_inc((SV *)did_store)));
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
+
+
+
+
+
+void
+fc_get(obj, key)
+    SV * obj;
+    SV * key;
+  INIT:
+    int key_len, val_len, found;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, flags = 0;
+    STRLEN pl_key_len;
+    SV * val;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Only lock and read the page if the key might be there */
+    if (mmc_bloom_check(cache, hash_page, hash_slot)) {
+      if (mmc_lock(cache, hash_page) != 0)
+        croak("%s", mmc_error(cache));
+
+      /* Get value data pointer */
+      found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags);
+      val = fc_read_sv(aTHX_ found, val_ptr, val_len, &flags);
+
+      mmc_unlock(cache);
+    } else {
+      found = -1;
+      val = &PL_sv_undef;
+    }
+
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)!found)));
+
+
+void
+fc_set(obj, key, val, expire_seconds, in_flags, wb, soft_seconds = (U32)-1, recompute_ms = 0, tags = 0)
+    SV * obj;
+    SV * key;
+    SV * val;
+    U32 expire_seconds;
+    U32 in_flags;
+    int wb;
+    U32 soft_seconds;
+    U32 recompute_ms;
+    SV * tags;
+  INIT:
+    int key_len, val_len, did_store, item, n_tags;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, * tag_hashes = 0;
+    STRLEN pl_key_len;
+    fc_num num;
+    AV * wb_items = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Get value data pointer and flags */
+    fc_write_sv(aTHX_ key, val, &val_ptr, &val_len, (MU32 *)&in_flags, &num);
+
+    /* Tagged items are referenced from the page's tag index */
+    n_tags = fc_tag_hashes(aTHX_ cache, tags, &tag_hashes);
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Create space if needed, and store */
+    fc_do_expunge(aTHX_ cache, 2, 1, key_len + val_len, wb_items);
+    did_store = fc_write_tagged(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_seconds, (MU32)soft_seconds, (MU32)recompute_ms, (MU32)in_flags, tag_hashes, n_tags);
+
+    mmc_unlock(cache);
+
+    XPUSHs(sv_2mortal(newSViv((IV)did_store)));
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
+
+
+void
+fc_get_cas(obj, key)
+    SV * obj;
+    SV * key;
+  INIT:
+    int key_len, val_len, found;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, flags = 0;
+    MU32 cas = 0;
+    STRLEN pl_key_len;
+    SV * val;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Get value data pointer and CAS value */
+    found = mmc_read_cas(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags, &cas);
+    val = fc_read_sv(aTHX_ found, val_ptr, val_len, &flags);
+
+    mmc_unlock(cache);
+
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)!found)));
+    XPUSHs(sv_2mortal(newSVuv((UV)cas)));
+
+
+void
+fc_set_cas(obj, key, val, expire_seconds, in_flags, wb, cas, soft_seconds = (U32)-1, recompute_ms = 0, tags = 0)
+    SV * obj;
+    SV * key;
+    SV * val;
+    U32 expire_seconds;
+    U32 in_flags;
+    int wb;
+    UV cas;
+    U32 soft_seconds;
+    U32 recompute_ms;
+    SV * tags;
+  INIT:
+    int key_len, val_len, did_store, item, n_tags;
+    void * key_ptr, * val_ptr;
+    MU32 * tag_hashes = 0;
+    MU32 hash_page, hash_slot;
+    STRLEN pl_key_len;
+    fc_num num;
+    AV * wb_items = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Get value data pointer and flags */
+    fc_write_sv(aTHX_ key, val, &val_ptr, &val_len, (MU32 *)&in_flags, &num);
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    n_tags = fc_tag_hashes(aTHX_ cache, tags, &tag_hashes);
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Create space if needed, and store if item is unchanged */
+    fc_do_expunge(aTHX_ cache, 2, 1, key_len + val_len, wb_items);
+    if (mmc_check_cas(cache, hash_slot, key_ptr, key_len, (MU32)cas))
+      did_store = fc_write_tagged(cache, hash_slot, key_ptr, key_len, val_ptr, val_len,
+          (MU32)expire_seconds, (MU32)soft_seconds, (MU32)recompute_ms, (MU32)in_flags, tag_hashes, n_tags);
+    else
+      did_store = -1;
+
+    mmc_unlock(cache);
+
+    XPUSHs(sv_2mortal(newSViv((IV)did_store)));
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
+
+
+void
+fc_incr(obj, key, delta, initial, expire_seconds, in_flags, wb)
+    SV * obj;
+    SV * key;
+    IV delta;
+    IV initial;
+    U32 expire_seconds;
+    U32 in_flags;
+    int wb;
+  INIT:
+    int key_len, res, item;
+    void * key_ptr;
+    MU32 hash_page, hash_slot;
+    MI64 value = 0;
+    STRLEN pl_key_len;
+    AV * wb_items = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+    if (SvUTF8(key))
+      in_flags |= FC_UTF8KEY;
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Create space in case a new counter is needed, and update */
+    fc_do_expunge(aTHX_ cache, 2, 1, key_len + (int)sizeof(MI64), wb_items);
+    res = mmc_incr(cache, hash_slot, key_ptr, key_len, (MI64)delta, (MI64)initial,
+        (MU32)expire_seconds, (MU32)in_flags, &value);
+
+    mmc_unlock(cache);
+
+    /* New value, or undef if not a number or couldn't store */
+    XPUSHs(res == 0 ? sv_2mortal(newSViv((IV)value)) : &PL_sv_undef);
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
+
+
+void
+fc_append(obj, key, data, prepend, expire_seconds, in_flags, wb)
+    SV * obj;
+    SV * key;
+    SV * data;
+    int prepend;
+    U32 expire_seconds;
+    U32 in_flags;
+    int wb;
+  INIT:
+    int key_len, data_len, val_len = 0, res, mode, item;
+    void * key_ptr, * data_ptr;
+    MU32 hash_page, hash_slot;
+    STRLEN pl_key_len;
+    fc_num num;
+    AV * wb_items = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Get data pointer and flags */
+    fc_write_sv(aTHX_ key, data, &data_ptr, &data_len, (MU32 *)&in_flags, &num);
+    in_flags &= ~FC_UNDEF;
+
+    /* Want list of expunged keys/values? */
+    if (wb)
+      wb_items = (AV *)sv_2mortal((SV *)newAV());
+
+    /* Hash key to get page and slot */
+    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Most appends fit in place. If not, create space for the
+     * whole new value and try again. If the expunge removed the
+     * value itself, don't store just the new data instead */
+    mode = prepend ? MMC_PREPEND : 0;
+    res = mmc_append(cache, hash_slot, key_ptr, key_len, data_ptr, data_len, mode,
+        (MU32)expire_seconds, (MU32)in_flags, &val_len);
+    if (res == 0) {
+      fc_do_expunge(aTHX_ cache, 2, 1, key_len + val_len, wb_items);
+      res = mmc_append(cache, hash_slot, key_ptr, key_len, data_ptr, data_len, mode | MMC_EXISTING,
+          (MU32)expire_seconds, (MU32)in_flags, &val_len);
+    }
+
+    mmc_unlock(cache);
+
+    XPUSHs(sv_2mortal(newSViv((IV)res)));
+    if (wb_items) {
+      for (item = 0; item <= av_len(wb_items); item++) {
+        XPUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, item, 0))));
+      }
+    }
 
 
 NO_OUTPUT void
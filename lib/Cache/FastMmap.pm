@@ -293,7 +293,7 @@ use strict;
 use warnings;
 use bytes;
 
-our $VERSION = '1.40';
+our $VERSION = '1.41';
 
 require XSLoader;
 XSLoader::load('Cache::FastMmap', $VERSION);
@@ -302,7 +302,16 @@ XSLoader::load('Cache::FastMmap', $VERSION);
 #  if we have empty_on_exit set
 our %LiveCaches;
 
+# Changed since read from the store (MMC_DIRTY in mmap_cache.h)
 use constant FC_ISDIRTY => 1;
+# Native counter created by incr() (MMC_COUNTER in mmap_cache.h)
+use constant FC_COUNTER => 1<<28;
+# Value returned is past its soft expiry time (MMC_STALE in mmap_cache.h)
+use constant FC_STALE => 1<<26;
+# Value returned was chosen to expire early (MMC_EARLY in mmap_cache.h)
+use constant FC_EARLY => 1<<24;
+# Plain scalar stored without the serializer (FC_SCALAR in FastMmap.xs)
+use constant FC_SCALAR => 1<<23;
 # }}}
 
 =item I<new(%Opts)>
@@ -335,6 +344,28 @@ the the cache file in an inconsistent state.
 Store values as raw binary data rather than using Storable to free/thaw
 data structures (default: 0)
 
+=item * B<serializer>
+
+What to use to freeze/thaw references when not using I<raw_values>.
+Either 'storable' for Storable, 'sereal' for Sereal::Encoder and
+Sereal::Decoder, which is faster and more compact, or an array ref
+of your own freeze and thaw subs, which are passed a reference to
+the value and the frozen data respectively:
+
+  serializer => [ sub { encode_json($_[0]) }, sub { decode_json($_[0]) } ],
+
+Values that aren't references (strings, integers, floating point
+numbers and undef) are stored as they are with a type flag, so
+they don't pay the time or space cost of the serializer at all,
+unless I<compress> is set or I<native_scalars> is 0. Only change
+either of these with I<init_file>, since values stored one way
+can't be read back the other. (default: 'storable')
+
+=item * B<native_scalars>
+
+Set to 0 to freeze/thaw values that aren't references with the
+I<serializer> too, as older versions did (default: 1)
+
 =item * B<compress>
 
 Compress the value (but not the key) before storing into the cache. If
@@ -353,7 +384,9 @@ the cache is counted, and every read to the cache that finds a value
 in the cache is also counted. You can then retrieve these values
 via the get_statistics() call. This causes every read action to
 do a write on a page, which can cause some more IO, so it's
-disabled by default. (default: 0)
+disabled by default. It also means reads of keys not in the cache
+always have to lock the page, rather than being answered by the
+page's bloom filter without locking. (default: 0)
 
 =item * B<expire_time>
 
@@ -362,6 +395,43 @@ means does no explicit expiry time, and values are expired only based
 on LRU usage. Can be expressed as 1m, 1h, 1d for minutes/hours/days
 respectively. (default: 0)
 
+=item * B<soft_expire_time>
+
+Time in seconds after which values become stale, but are still
+returned until they reach I<expire_time>. When a get() finds a
+stale value and there's a I<read_cb>, one process is chosen to
+call the I<read_cb> and store the fresh value, while other
+processes just get the stale value rather than all waiting on the
+underlying data store. If the process refreshing the value fails,
+another one is chosen after I<read_lease> seconds (or 10 if
+I<read_lease> isn't set). Stale values are only removed from the
+cache once they reach I<expire_time>, or to make space for other
+values. Without a I<read_cb>, see get_with_status(). Can be
+expressed the same way as I<expire_time>. (default: 0, values
+never become stale)
+
+=item * B<expire_jitter>
+
+Percentage to randomly reduce the expiry time of each value
+written by, so values written at the same time (eg when warming
+up a cache) don't all expire in the same second and cause a burst
+of I<read_cb> calls. With an I<expire_time> of 1h and an
+I<expire_jitter> of 10, values expire between 54 and 60 minutes
+after they're written. (default: 0)
+
+=item * B<early_expire_beta>
+
+Treat values as expired early in get(), with a probability that
+rises as their expiry time gets closer and the longer they took
+to calculate (the XFetch algorithm). This means one process
+usually refreshes a popular value shortly before it expires,
+rather than many processes all missing on it at once. Larger
+values expire values earlier, 1 is a good default. The time taken
+to calculate a value is recorded when get() calls the
+I<read_cb>, or can be passed as the I<recompute_time> option to
+set(). Values with no recorded time never expire early. Needs the
+Time::HiRes module. (default: 0, no early expiry)
+
 =back
 
 You may specify the cache size as:
@@ -411,6 +481,21 @@ Should return the value to use. This value will be saved in the cache
 for future retrievals. Return undef if there is no value for the
 given key
 
+=item * B<read_many_cb>
+
+Callback to read data for many keys from the underlying data store
+in one go. Called by get_many() with all the keys it didn't find
+in the cache as:
+
+  $read_many_cb->($context, [ $Key1, $Key2, ... ])
+
+Should return a hash ref of the values found. Keys missing from
+the hash ref are treated the same as a I<read_cb> returning
+undef. No pages are locked during the call, and the values
+returned are stored into the cache with one lock of each page.
+If there's no I<read_cb>, get() calls this with a single key
+instead.
+
 =item * B<write_cb>
 
 Callback to write data to the underlying data store.
@@ -432,6 +517,33 @@ want to write back values which aren't expired.
 Also remember that I<write_cb> may be called in a different process
 to the one that placed the data in the cache in the first place
 
+=item * B<write_many_cb>
+
+Callback to write data for many keys to the underlying data store
+in one go. Called as:
+
+  $write_many_cb->($context, [ [ $Key1, $Value1, $ExpiryTime1 ], ... ])
+
+If given, it's used instead of the I<write_cb> whenever there's
+more than one item to write, which is by set_many() in
+'write_through' mode, for the items expunged from a page in
+'write_back' mode, by flush_dirty() and checkpoint(), and when
+writes held back by I<write_coalesce> are written. If there's no
+I<write_cb>, single items are written with this as well.
+
+=item * B<write_coalesce>
+
+In 'write_through' mode, hold back writes to the underlying store
+for up to this many seconds (which can be fractional), so repeated
+writes of the same key are merged into one write of the latest
+value. The held back writes are written together (with the
+I<write_many_cb> if given) by the first write after the time is up,
+by flush_writes(), or when the cache object is cleaned up. A
+remove() of a key drops any held back write for it. Held back
+writes are only kept in the process that made them, so other
+processes reading the underlying store directly may see old
+values in the meantime. (default: 0, write immediately)
+
 =item * B<delete_cb>
 
 Callback to delete data from the underlying data store.  Called as:
@@ -452,6 +564,39 @@ the I<read_cb>
 
 Either 'write_back' or 'write_through'. (default: write_through)
 
+=item * B<write_behind_queue>
+
+Size of a queue in the cache file for dirty items in write_back
+mode. Normally when a set() needs to push dirty items out of a
+page to make space, it calls the I<write_cb> for them before
+returning. With a queue, they're added to the queue instead, and
+a separate process should call flush_dirty() regularly to write
+them back. If the queue is full, items are written back by the
+set() as before. get() and get_many() still return unexpired
+items from the queue until they're written back, rather than
+reading older values from the underlying store, and remove(),
+clear(), remove_matching(), invalidate_namespace() and
+invalidate_tag() drop matching items from it. Can be expressed as 1k, 1m for
+kilobytes or megabytes. (default: 0, no queue)
+
+=item * B<namespaces>
+
+Number of namespace generation counters to keep in the cache file,
+up to 255. Items stored with a I<namespace> option to set() can then
+all be invalidated at once with invalidate_namespace(), without
+locking or searching any pages. Namespace names are hashed to one of
+the counters, so names that share a counter are invalidated
+together. (default: 0, no namespaces)
+
+=item * B<tag_slots>
+
+Number of tag references to keep in the cache file for each page.
+Items stored with a I<tags> option to set() get one reference for
+each tag, which lets invalidate_tag() find and remove them by only
+locking the pages that have any. If a page runs out of references,
+tagged items that can't be added aren't stored. (default: 0, no
+tags)
+
 =item * B<allow_recursive>
 
 If you're using a callback function, then normally the cache is not
@@ -463,6 +608,28 @@ unexpected effects. You shouldn't set this unless you know you
 want to be able to recall to the cache within a callback.
 (default: 0)
 
+=item * B<read_lease>
+
+Stop many processes calling the I<read_cb> for the same key at
+once when it's missing from the cache (eg a popular item just
+expired). When set, the first process to miss takes a lease on the
+key for this many seconds by storing a placeholder item, then
+unlocks the page while calling I<read_cb>, as with
+I<allow_recursive>. Other processes that miss on the key while the
+lease is held wait for the value to be stored rather than calling
+I<read_cb> themselves. The lease is given up when the value is
+stored, or if I<read_cb> dies or returns undef and
+I<cache_not_found> isn't set. If the leasing process dies, the
+lease expires after this many seconds. Not used by get_and_set().
+(default: 0)
+
+=item * B<read_lease_wait>
+
+Maximum time in seconds a process waits for the value while
+another process holds the I<read_lease>. If the value still isn't
+there after this, the process calls I<read_cb> itself.
+(default: the read_lease time)
+
 =item * B<empty_on_exit>
 
 When you have 'write_back' mode enabled, then
@@ -531,21 +698,46 @@ sub new {
   # Storing raw/storable values?
   my $raw_values = $Self->{raw_values} = int($Args{raw_values} || 0);
 
-  # Need storable module if not using raw values
+  # Need a serializer if not using raw values
   if (!$raw_values) {
-    eval "use Storable qw(freeze thaw); 1;"
-      || die "Could not load Storable module: $@";
+    my $serializer = $Args{serializer} || 'storable';
+    if (ref($serializer) eq 'ARRAY') {
+      @$Self{qw(freeze thaw)} = @$serializer;
+    } elsif ($serializer eq 'sereal') {
+      eval "use Sereal::Encoder; use Sereal::Decoder; 1;"
+        || die "Could not load Sereal modules: $@";
+      my ($Encoder, $Decoder) = (Sereal::Encoder->new(), Sereal::Decoder->new());
+      @$Self{qw(freeze thaw)} = (sub { $Encoder->encode($_[0]) }, sub { $Decoder->decode($_[0]) });
+    } elsif ($serializer eq 'storable') {
+      eval "use Storable; 1;"
+        || die "Could not load Storable module: $@";
+      @$Self{qw(freeze thaw)} = (\&Storable::freeze, \&Storable::thaw);
+    } else {
+      die "Unknown serializer '$serializer'";
+    }
   }
 
   # Compress stored values?
   my $compress = $Self->{compress} = int($Args{compress} || 0);
 
+  # Store plain scalars without the serializer? Kept as the flag
+  #  to pass with values that aren't references
+  my $native_scalars = defined($Args{native_scalars}) ? $Args{native_scalars} : 1;
+  $Self->{scalar_flag} = !$raw_values && !$compress && $native_scalars ? FC_SCALAR : 0;
+
   # Need Compress::Zlib module if using compression
   if ($compress) {
     eval "use Compress::Zlib; 1;"
       || die "Could not load Compress::Zlib module: $@";
   }
 
+  # Early expiry needs high resolution times for recompute times
+  my $early_expire_beta = $Self->{early_expire_beta} = $Args{early_expire_beta} || 0;
+  if ($early_expire_beta) {
+    eval "use Time::HiRes; 1;"
+      || die "Could not load Time::HiRes module: $@";
+  }
+
   # If using empty_on_exit, need to track used caches
   my $empty_on_exit = $Self->{empty_on_exit} = int($Args{empty_on_exit} || 0);
   
@@ -557,6 +749,7 @@ sub new {
 
   # Work out expiry time in seconds
   my $expire_time = $Self->{expire_time} = parse_expire_time($Args{expire_time});
+  my $soft_expire_time = parse_expire_time($Args{soft_expire_time});
 
   # Function rounds to the nearest power of 2
   sub RoundPow2 { return int(2 ** int(log($_[0])/log(2)) + 0.1); }
@@ -565,6 +758,13 @@ sub new {
   my ($cache_size, $num_pages, $page_size);
 
   my %Sizes = (k => 1024, m => 1024*1024);
+  my $queue_size = $Args{write_behind_queue} || 0;
+  $queue_size *= $Sizes{lc($1)} if $queue_size =~ s/([km])$//i;
+  if ($queue_size) {
+    eval "use Time::HiRes; 1;"
+      || die "Could not load Time::HiRes module: $@";
+  }
+
   if ($cache_size = $Args{cache_size}) {
     $cache_size *= $Sizes{lc($1)} if $cache_size =~ s/([km])$//i;
 
@@ -609,10 +809,31 @@ sub new {
 
   # Save read through/write back/write through details
   my $write_back = ($Args{write_action} || 'write_through') eq 'write_back';
-  @$Self{qw(context read_cb write_cb delete_cb)}
-    = @Args{qw(context read_cb write_cb delete_cb)};
+  @$Self{qw(context read_cb read_many_cb write_cb write_many_cb delete_cb)}
+    = @Args{qw(context read_cb read_many_cb write_cb write_many_cb delete_cb)};
+
+  # get() can use a read_many_cb for one key
+  if (!$Self->{read_cb} && (my $read_many_cb = $Self->{read_many_cb})) {
+    $Self->{read_cb} = sub {
+      my $Vals = $read_many_cb->($_[0], [ $_[1] ]);
+      return $Vals ? $Vals->{$_[1]} : undef;
+    };
+  }
+
+  # Single writes can use a write_many_cb too
+  if (!$Self->{write_cb} && (my $write_many_cb = $Self->{write_many_cb})) {
+    $Self->{write_cb} = sub { $write_many_cb->($_[0], [ [ @_[1 .. 3] ] ]); };
+  }
+
+  # Coalesced writes need high resolution times for the window
+  if ($Self->{write_coalesce} = $Args{write_coalesce} || 0) {
+    eval "use Time::HiRes; 1;"
+      || die "Could not load Time::HiRes module: $@";
+  }
   @$Self{qw(cache_not_found allow_recursive write_back)}
     = (@Args{qw(cache_not_found allow_recursive)}, $write_back);
+  $Self->{read_lease} = parse_expire_time($Args{read_lease}) if $Args{read_lease};
+  $Self->{read_lease_wait} = $Args{read_lease_wait} || $Self->{read_lease};
   @$Self{qw(unlink_on_exit enable_stats)}
     = (@Args{qw(unlink_on_exit)}, $enable_stats);
 
@@ -630,7 +851,13 @@ sub new {
   fc_set_param($Cache, 'test_file', $test_file);
   fc_set_param($Cache, 'page_size', $page_size);
   fc_set_param($Cache, 'num_pages', $num_pages);
+  fc_set_param($Cache, 'queue_size', int($queue_size));
+  fc_set_param($Cache, 'namespaces', int($Args{namespaces} || 0));
+  fc_set_param($Cache, 'tag_slots', int($Args{tag_slots} || 0));
   fc_set_param($Cache, 'expire_time', $expire_time);
+  fc_set_param($Cache, 'soft_expire_time', $soft_expire_time);
+  fc_set_param($Cache, 'expire_jitter', int($Args{expire_jitter} || 0));
+  fc_set_param($Cache, 'early_expire_beta', int($early_expire_beta * 1000 + 0.5));
   fc_set_param($Cache, 'share_file', $share_file);
   fc_set_param($Cache, 'start_slots', $start_slots);
   fc_set_param($Cache, 'catch_deadlocks', $catch_deadlocks);
@@ -662,54 +889,106 @@ unless you read the code to understand how it works
 sub get {
   my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
 
-  # Hash value, lock page, read result
-  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
-  my $Unlock = $Self->_lock_page($HashPage);
-  my ($Val, $Flags, $Found) = fc_read($Cache, $HashSlot, $_[1]);
+  my ($Val, $Flags, $Found, $Unlock);
+  my $SkipUnlock = $_[2] && $_[2]->{skip_unlock};
+  my $read_cb = $Self->{read_cb};
+
+  # Nothing to do with the page locked after the read, so hash,
+  #  lock, read and unlock in one call
+  if (!$read_cb && !$SkipUnlock) {
+    ($Val, $Flags, $Found) = fc_get($Cache, $_[1]);
+    ($Val, $Flags, $Found) = fc_queue_get($Cache, [ $_[1] ])
+      if !$Found && fc_queue_count($Cache);
 
-  # Value not found, check underlying data store
-  if (!$Found && (my $read_cb = $Self->{read_cb})) {
+    # Chosen to expire early, caller should recalculate it
+    $Val = undef if $Flags & FC_EARLY;
 
-    # Callback to read from underlying data store
-    # (unlock page first if we allow recursive calls
-    $Unlock = undef if $Self->{allow_recursive};
-    $Val = eval { $read_cb->($Self->{context}, $_[1]); };
-    my $Err = $@;
-    $Unlock = $Self->_lock_page($HashPage) if $Self->{allow_recursive};
+  } else {
+
+    # Hash value, lock page, read result
+    my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+    $Unlock = $Self->_lock_page($HashPage);
+    ($Val, $Flags, $Found) = fc_read($Cache, $HashSlot, $_[1]);
+
+    # Changed items pushed out to the write behind queue are newer
+    #  than the underlying data store, so mustn't be read from it
+    ($Val, $Flags, $Found) = fc_queue_get($Cache, [ $_[1] ])
+      if !$Found && fc_queue_count($Cache);
+
+    # Value not found, and using leases, either take the lease or
+    #  wait for the process that has it to store the value
+    my $Leased;
+    if (!$Found && $read_cb && $Self->{read_lease} && !$SkipUnlock) {
+      ($Leased, $Val, $Flags, $Found) = $Self->_take_lease($HashPage, $HashSlot, $_[1], $Unlock);
+    }
 
-    # Pass on any error
-    if ($Err) {
-      die $Err;
+    # Value found but stale, one process gets to refresh it from the
+    #  underlying data store, the rest just return the stale value.
+    #  Values chosen to expire early are refreshed the same way
+    my $Refresh;
+    if ($Found && $read_cb && !$SkipUnlock) {
+      $Refresh = ($Flags & FC_EARLY)
+        || (($Flags & FC_STALE) && fc_refresh($Cache, $HashSlot, $_[1], $Self->{read_lease} || 10));
     }
 
-    # If we found it, or want to cache not-found, store back into our cache
-    if (defined $Val || $Self->{cache_not_found}) {
+    # Value not found, check underlying data store
+    if ((!$Found || $Refresh) && $read_cb) {
+
+      # Callback to read from underlying data store
+      # (unlock page first if we allow recursive calls, have a lease,
+      #  or are refreshing a value other processes are still reading)
+      my $DoUnlock = $Self->{allow_recursive} || $Leased || $Refresh;
+      $Unlock = undef if $DoUnlock;
+      my $Start = $Self->{early_expire_beta} && Time::HiRes::time();
+      my $ReadVal = eval { $read_cb->($Self->{context}, $_[1]); };
+      my $Err = $@;
+      my $RecomputeMs = $Start ? int((Time::HiRes::time() - $Start) * 1000) : 0;
+      $Unlock = $Self->_lock_page($HashPage) if $DoUnlock;
+
+      # Pass on any error
+      if ($Err) {
+        fc_lease_release($Cache, $HashSlot, $_[1]) if $Leased;
+        die $Err;
+      }
+
+      # If we found it, or want to cache not-found, store back into our cache
+      # (a failed refresh keeps the stale value)
+      if (defined $ReadVal || (!$Refresh && $Self->{cache_not_found})) {
+        ($Val, $Flags) = ($ReadVal, 0);
 
-      # Are we doing writeback's? If so, need to mark as dirty in cache
-      my $write_back = $Self->{write_back};
+        # Are we doing writeback's? If so, need to mark as dirty in cache
+        my $write_back = $Self->{write_back};
 
-      # If not using raw values, use freeze() to turn data 
-      $Val = freeze(\$Val) if !$Self->{raw_values};
-      $Val = Compress::Zlib::memGzip($Val) if $Self->{compress};
+        # If not using raw values, use freeze() to turn data 
+        my $Scalar = ref($Val) ? 0 : $Self->{scalar_flag};
+        $Val = $Self->{freeze}->(\$Val) if !$Self->{raw_values} && !$Scalar;
+        $Val = Compress::Zlib::memGzip($Val) if $Self->{compress};
 
-      # Get key/value len (we've got 'use bytes'), and do expunge check to
-      #  create space if needed
-      my $KVLen = length($_[1]) + (defined($Val) ? length($Val) : 0);
-      $Self->_expunge_page(2, 1, $KVLen);
+        # Get key/value len (we've got 'use bytes'), and do expunge check to
+        #  create space if needed (length of a copy so numbers stay numbers)
+        my $KVLen = length($_[1]) + (defined($Val) ? length(my $Tmp = $Val) : 0);
+        $Self->_expunge_page(2, 1, $KVLen);
+
+        fc_write($Cache, $HashSlot, $_[1], $Val, -1, $Scalar, -1, $RecomputeMs);
+        $Flags = $Scalar;
+      }
 
-      fc_write($Cache, $HashSlot, $_[1], $Val, -1, 0);
+      # Give up lease if nothing stored
+      fc_lease_release($Cache, $HashSlot, $_[1]) if $Leased;
     }
-  }
 
-  # Unlock page and return any found value
-  # Unlock is done only if we're not in the middle of a get_set() operation.
-  my $SkipUnlock = $_[2] && $_[2]->{skip_unlock};
-  $Unlock = undef unless $SkipUnlock;
+    # Unlock page and return any found value
+    # Unlock is done only if we're not in the middle of a get_set() operation.
+    $Unlock = undef unless $SkipUnlock;
+  }
 
   # If not using raw values, use thaw() to turn data back into object
   # (gunzip from tmp var: https://rt.cpan.org/Ticket/Display.html?id=72945)
-  $Val = Compress::Zlib::memGunzip(my $Tmp = $Val) if defined($Val) && $Self->{compress};
-  $Val = ${thaw($Val)} if defined($Val) && !$Self->{raw_values};
+  # Native counters are always returned as plain numbers
+  if (defined($Val) && !($Flags & (FC_COUNTER | FC_SCALAR))) {
+    $Val = Compress::Zlib::memGunzip(my $Tmp = $Val) if $Self->{compress};
+    $Val = ${$Self->{thaw}->($Val)} if !$Self->{raw_values};
+  }
 
   # If explicitly asked to skip unlocking, we return the reference to the unlocker
   return ($Val, $Unlock) if $SkipUnlock;
@@ -717,13 +996,239 @@ sub get {
   return $Val;
 }
 
+=item I<get_with_status($Key)>
+
+Returns a three value list of the value for $Key (same as get(),
+but without calling the I<read_cb>), whether the value is stale
+(see I<soft_expire_time>), and whether this caller should refresh
+it. Only one caller at a time is told to refresh a stale value,
+so you can do the refresh yourself without every process hitting
+the underlying data store at once:
+
+  my ($Value, $Stale, $Refresh) = $Cache->get_with_status($Key);
+  $Cache->set($Key, $Value = load($Key)) if !defined $Value || $Refresh;
+
+If the refreshing caller doesn't store a new value, another
+caller is told to refresh it after I<read_lease> seconds (or 10
+if I<read_lease> isn't set). With I<early_expire_beta>, callers
+are also told to refresh values chosen to expire early, which
+aren't marked as stale.
+
+=cut
+sub get_with_status {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  my $Unlock = $Self->_lock_page($HashPage);
+  my ($Val, $Flags, $Found) = fc_read($Cache, $HashSlot, $_[1]);
+
+  my $Stale = $Found && ($Flags & FC_STALE) ? 1 : 0;
+  my $Refresh = $Stale ? fc_refresh($Cache, $HashSlot, $_[1], $Self->{read_lease} || 10) : 0;
+  $Refresh = 1 if $Found && ($Flags & FC_EARLY);
+  $Unlock = undef;
+
+  # If not using raw values, use thaw() to turn data back into object
+  if (defined($Val) && !($Flags & (FC_COUNTER | FC_SCALAR))) {
+    $Val = Compress::Zlib::memGunzip(my $Tmp = $Val) if $Self->{compress};
+    $Val = ${$Self->{thaw}->($Val)} if !$Self->{raw_values};
+  }
+
+  return ($Val, $Stale, $Refresh);
+}
+
+=item I<with_value($Key, $Sub)>
+
+Call $Sub with a read only scalar that points directly at the
+value data for $Key inside the cache file, so no copy of the
+value is made. The scalar is undef if the key isn't found.
+
+  $Cache->with_value($Key, sub { print $Socket $_[0] if defined $_[0]; });
+
+The page is kept locked while $Sub runs, which is what keeps the
+data in place, so keep it short. After $Sub returns (or dies),
+the scalar is detached from the cache and becomes undef, so copy
+it if you need the value afterwards. Returns whatever $Sub returns.
+
+This needs I<raw_values> and no I<compress>, since there's no
+other way to use the stored data without making a copy of it.
+
+=cut
+sub with_value {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  !$Self->{raw_values} || $Self->{compress}
+    and die "with_value() needs raw_values and no compress";
+
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+
+  # Detach the view from the page before unlocking, even on a die
+  my $View;
+  my $Unlock = Cache::FastMmap::OnLeave->new(sub {
+    fc_release_view($View);
+    fc_unlock($Cache) if fc_is_locked($Cache);
+  });
+  fc_lock($Cache, $HashPage);
+
+  fc_read_view($Cache, $HashSlot, $_[1], $View);
+  return $_[2]->($View);
+}
+
+=item I<get_to_fh($Key, $FH)>
+
+Write the value for $Key directly from the cache file to the
+file handle $FH (or file descriptor number) with no intermediate
+copy. Returns the number of bytes written, or undef if the key
+wasn't found. Dies if the write fails.
+
+As with with_value(), this needs I<raw_values> and no
+I<compress>. The write bypasses any PerlIO buffering on $FH, so
+flush any data you've already printed to it first. The page is
+locked during the write, so only use this on handles that
+won't block for long.
+
+=cut
+sub get_to_fh {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  !$Self->{raw_values} || $Self->{compress}
+    and die "get_to_fh() needs raw_values and no compress";
+
+  my $Fd = ref($_[2]) || $_[2] !~ /^\d+$/ ? fileno($_[2]) : $_[2];
+  defined $Fd || die "get_to_fh() needs a file handle";
+
+  my $Written = fc_read_fd($Cache, $_[1], $Fd);
+  return undef if $Written == -1;
+  die "Write to file handle failed: $!" if $Written < 0;
+
+  return $Written;
+}
+
+=item I<get_into($Key, $Buffer)>
+
+Like get(), but copies the value found into the existing
+scalar $Buffer, reusing its string buffer rather than creating
+a new scalar. The buffer is only grown if it's too small, so a
+loop reading values into the same $Buffer makes no memory
+allocations once the buffer is big enough. $Buffer is set to
+undef if the key isn't found.
+
+Returns true if the key was found.
+
+Only I<raw_values> without I<compress> can be copied straight
+into the buffer. Otherwise, and when the key isn't found and
+there's a I<read_cb>, this is the same as C<$Buffer = get($Key)>.
+
+=cut
+sub get_into {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  if ($Self->{raw_values} && !$Self->{compress}) {
+    my ($Flags, $Found) = fc_get_into($Cache, $_[1], $_[2]);
+    return 1 if $Found;
+    return 0 if !$Self->{read_cb};
+  }
+
+  $_[2] = $Self->get($_[1]);
+  return defined($_[2]) ? 1 : 0;
+}
+
+=item I<get_range($Key, $Offset, [ $Length ])>
+
+Returns $Length bytes of the value for $Key starting at byte
+$Offset, copying only that part of the value out of the cache.
+A negative $Offset counts back from the end of the value, and
+if $Length is undef or negative, everything to the end of the
+value is returned. As with substr(), the range is clipped to the
+value, so an $Offset past the end returns an empty string.
+Returns undef if the key isn't found.
+
+In list context, returns the range and the full length of the
+value, which is useful to fill in a HTTP Content-Range header.
+
+  my ($Part, $Total) = $Cache->get_range($Key, 0, 1024);
+
+This needs I<raw_values> and no I<compress>. Offsets and lengths
+are always in bytes, and the data returned is a byte string, even
+if the value was stored as a character string. For a counter
+created by incr(), the range is taken from the decimal string
+that get() would return.
+
+=cut
+sub get_range {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  !$Self->{raw_values} || $Self->{compress}
+    and die "get_range() needs raw_values and no compress";
+
+  my $Len = defined($_[3]) ? $_[3] : -1;
+  my ($Val, $Flags, $Found, $Total) = fc_get_range($Cache, $_[1], $_[2] || 0, $Len);
+  return wantarray ? ($Val, $Found ? $Total : undef) : $Val;
+}
+
+=item I<exists($Key)>
+
+Returns true if $Key is in the cache and hasn't expired. This
+doesn't copy or thaw the value, so is much cheaper than checking
+whether get() returns undef for large values. It also doesn't
+count as a read for get_statistics(), or as a use of the item
+for working out which items to expunge. The I<read_cb> isn't
+called.
+
+In list context, returns a three value list of whether $Key
+exists, the number of seconds until it expires (undef if it
+never expires) and the length of the stored value in bytes
+(after any freeze/compress).
+
+  my ($Exists, $TTL, $Length) = $Cache->exists($Key);
+
+=cut
+sub exists {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my ($Found, $ExpireTime, $Length) = fc_exists($Cache, $_[1]);
+  return $Found ? 1 : 0 if !wantarray;
+  return (0, undef, undef) if !$Found;
+  return (1, $ExpireTime ? $ExpireTime - time() : undef, $Length);
+}
+
+=item I<exists_many([ $Key1, $Key2, ... ], [ $Details ])>
+
+Same as exists() for each of the given keys, locking each page
+only once. Returns a list of true/false values in the same order
+as the keys. If $Details is true, each item returned is instead
+an array ref of the three values exists() returns in list
+context.
+
+=cut
+sub exists_many {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my @Details = fc_exists_many($Cache, $_[1]);
+  my $Now = time();
+
+  my @Exists;
+  while (my ($Found, $ExpireTime, $Length) = splice(@Details, 0, 3)) {
+    push @Exists, !$_[2] ? $Found :
+      $Found ? [ 1, $ExpireTime ? $ExpireTime - $Now : undef, $Length ] : [ 0, undef, undef ];
+  }
+
+  return @Exists;
+}
+
 =item I<set($Key, $Value, [ \%Options ])>
 
 Store specified key/value pair into cache
 
 I<%Options> is optional, and is used by get_and_set() to control
 the locking behaviour. For now, you should probably ignore it
-unless you read the code to understand how it works
+unless you read the code to understand how it works. It can also
+contain I<expire_time> and I<soft_expire_time> to override the
+cache defaults for this value, I<recompute_time>, the time in
+seconds it took to calculate the value, used by
+I<early_expire_beta>, I<namespace>, the name of the namespace
+to store the value in (see invalidate_namespace()), and I<tags>,
+a tag name or list of tag names the value depends on (see
+invalidate_tag()).
 
 This method returns true if the value was stored in the cache,
 false otherwise. See the PAGE SIZE AND KEY/VALUE LIMITS section
@@ -734,44 +1239,139 @@ sub set {
   my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
 
   # If not using raw values, use freeze() to turn data 
-  my $Val = $Self->{raw_values} ? $_[2] : freeze(\$_[2]);
+  my $Scalar = ref($_[2]) ? 0 : $Self->{scalar_flag};
+  my $Val = $Self->{raw_values} || $Scalar ? $_[2] : $Self->{freeze}->(\$_[2]);
   $Val = Compress::Zlib::memGzip($Val) if $Self->{compress};
 
   # Get opts, make compatible with Cache::Cache interface
   my $Opts = defined($_[3]) ? (ref($_[3]) ? $_[3] : { expire_time => $_[3] }) : undef;
   my $expire_seconds = defined($Opts && $Opts->{expire_time}) ? parse_expire_time($Opts->{expire_time}) : -1;
+  my $soft_seconds = defined($Opts && $Opts->{soft_expire_time}) ? parse_expire_time($Opts->{soft_expire_time}) : -1;
+  my $recompute_ms = $Opts && $Opts->{recompute_time} ? int($Opts->{recompute_time} * 1000) : 0;
+  my $NsFlags = $Opts && defined($Opts->{namespace}) ? $Self->_ns_flags($Opts->{namespace}) : 0;
+  my $Tags = $Opts && $Opts->{tags};
+  $Tags = [ $Tags ] if defined($Tags) && !ref($Tags);
 
-  # Hash value, lock page
-  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  # Are we doing writeback's? If so, need to mark as dirty in cache
+  my $write_back = $Self->{write_back};
 
   # If skip_lock is passed, it's a *reference* to an existing lock we
   #  have to take and delete so we can cleanup below before calling
   #  the callback
   my $Unlock = $Opts && $Opts->{skip_lock};
+  my $DidStore;
   if ($Unlock) {
     ($Unlock, $$Unlock) = ($$Unlock, undef);
+
+    # Get key/value len (we've got 'use bytes'), and do expunge check to
+    #  create space if needed
+    my (undef, $HashSlot) = fc_hash($Cache, $_[1]);
+    my $KVLen = length($_[1]) + (defined($Val) ? length(my $Tmp = $Val) : 0);
+    $Self->_expunge_page(2, 1, $KVLen);
+
+    # Now store into cache
+    $DidStore = fc_write($Cache, $HashSlot, $_[1], $Val, $expire_seconds, ($write_back ? FC_ISDIRTY : 0) | $Scalar | $NsFlags, $soft_seconds, $recompute_ms, $Tags);
+
+    # Unlock page
+    $Unlock = undef;
+
   } else {
-    $Unlock = $Self->_lock_page($HashPage);
+
+    # Hash, lock, expunge check, store and unlock in one call
+    my $WB = $write_back && $Self->{write_cb} ? 1 : 0;
+    ($DidStore, my @WBItems) = fc_set($Cache, $_[1], $Val, $expire_seconds, ($write_back ? FC_ISDIRTY : 0) | $Scalar | $NsFlags, $WB, $soft_seconds, $recompute_ms, $Tags);
+    $Self->_write_back_items(@WBItems);
+  }
+
+  # If we're doing write-through, or write-back and didn't get into cache,
+  #  write back to the underlying store
+  if ((!$write_back || !$DidStore) && $Self->{write_cb}) {
+    $Self->_write_through([ $_[1], $_[2] ]);
+  }
+
+  return $DidStore;
+}
+
+=item I<get_with_version($Key)>
+
+Returns a two value list of the value for $Key (same as get())
+and a version token for it. The version token changes every
+time the value is written, so it can be passed to
+set_if_version() to only store a new value if no other process
+has changed it in the meantime. The version token is 0 if $Key
+isn't in the cache.
+
+The I<read_cb> isn't called for keys not in the cache.
+
+=cut
+sub get_with_version {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my ($Val, $Flags, $Found, $Version) = fc_get_cas($Cache, $_[1]);
+
+  # If not using raw values, use thaw() to turn data back into object
+  if (defined($Val) && !($Flags & (FC_COUNTER | FC_SCALAR))) {
+    $Val = Compress::Zlib::memGunzip(my $Tmp = $Val) if $Self->{compress};
+    $Val = ${$Self->{thaw}->($Val)} if !$Self->{raw_values};
+  }
+
+  return ($Val, $Version);
+}
+
+=item I<set_if_version($Key, $Value, $Version, [ \%Options ])>
+
+Store $Value for $Key, but only if the current version of $Key
+is still $Version, as returned by get_with_version(). A $Version
+of 0 only stores if $Key isn't in the cache. Returns true if the
+value was stored, false if the version didn't match or the value
+couldn't be stored. I<%Options> is the same as for set().
+
+This allows an optimistic read-modify-write, where the page is
+only locked while the versions are compared and the value is
+written, rather than while the new value is calculated as with
+get_and_set(). If the version didn't match, just retry:
+
+  while (1) {
+    my ($Value, $Version) = $Cache->get_with_version($Key);
+    my $NewValue = calculate($Value);
+    last if $Cache->set_if_version($Key, $NewValue, $Version);
   }
 
+=cut
+sub set_if_version {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # If not using raw values, use freeze() to turn data 
+  my $Scalar = ref($_[2]) ? 0 : $Self->{scalar_flag};
+  my $Val = $Self->{raw_values} || $Scalar ? $_[2] : $Self->{freeze}->(\$_[2]);
+  $Val = Compress::Zlib::memGzip($Val) if $Self->{compress};
+
+  # Get opts, make compatible with Cache::Cache interface
+  my $Opts = defined($_[4]) ? (ref($_[4]) ? $_[4] : { expire_time => $_[4] }) : undef;
+  my $expire_seconds = defined($Opts && $Opts->{expire_time}) ? parse_expire_time($Opts->{expire_time}) : -1;
+  my $soft_seconds = defined($Opts && $Opts->{soft_expire_time}) ? parse_expire_time($Opts->{soft_expire_time}) : -1;
+  my $recompute_ms = $Opts && $Opts->{recompute_time} ? int($Opts->{recompute_time} * 1000) : 0;
+  my $NsFlags = $Opts && defined($Opts->{namespace}) ? $Self->_ns_flags($Opts->{namespace}) : 0;
+  my $Tags = $Opts && $Opts->{tags};
+  $Tags = [ $Tags ] if defined($Tags) && !ref($Tags);
+
   # Are we doing writeback's? If so, need to mark as dirty in cache
   my $write_back = $Self->{write_back};
+  my $write_cb = $Self->{write_cb};
 
-  # Get key/value len (we've got 'use bytes'), and do expunge check to
-  #  create space if needed
-  my $KVLen = length($_[1]) + (defined($Val) ? length($Val) : 0);
-  $Self->_expunge_page(2, 1, $KVLen);
+  # Hash, lock, expunge check, compare and store and unlock in one call
+  my ($DidStore, @WBItems) = fc_set_cas($Cache, $_[1], $Val, $expire_seconds,
+    ($write_back ? FC_ISDIRTY : 0) | $Scalar | $NsFlags, $write_back && $write_cb ? 1 : 0, $_[3] || 0,
+    $soft_seconds, $recompute_ms, $Tags);
+  $Self->_write_back_items(@WBItems);
 
-  # Now store into cache
-  my $DidStore = fc_write($Cache, $HashSlot, $_[1], $Val, $expire_seconds, $write_back ? FC_ISDIRTY : 0);
-
-  # Unlock page
-  $Unlock = undef;
+  # Version didn't match, nothing to write to the underlying store
+  return 0 if $DidStore < 0;
 
   # If we're doing write-through, or write-back and didn't get into cache,
   #  write back to the underlying store
-  if ((!$write_back || !$DidStore) && (my $write_cb = $Self->{write_cb})) {
-    eval { $write_cb->($Self->{context}, $_[1], $_[2]); };
+  if ((!$write_back || !$DidStore) && $write_cb) {
+    $Self->_write_through([ $_[1], $_[2] ]);
   }
 
   return $DidStore;
@@ -831,9 +1431,158 @@ sub get_and_set {
   return wantarray ? ($Value, $DidStore) : $Value;
 }
 
+=item I<incr($Key, [ $Delta, $Initial, $ExpireTime ])>
+
+Atomically add $Delta (default 1) to the native integer counter
+stored at $Key, and return the new value. If $Key isn't in the
+cache, a new counter of $Initial (default 0) plus $Delta is
+created, which expires after $ExpireTime (same format as the
+expire_time option to set(), default is the cache expire_time).
+Updating an existing counter doesn't change when it expires.
+
+  my $Hits = $Cache->incr("hits:$Ip");
+  die "Rate limit exceeded" if $Hits > 100;
+
+Counters are stored as 64 bit integers and updated in place in
+the cache file, with only the page lock held and no freeze/thaw
+or callbacks involved, so this is much quicker than doing the
+same thing with get_and_set().
+
+get() and the other read methods return the value of a counter
+as a plain number, even if raw_values or compress are not set.
+Storing a value with set() replaces the counter with a normal
+value. An existing value that's not a counter is converted to
+one if it's a native integer or a string of decimal digits that
+fits in 64 bits, which is only possible with raw_values or
+native_scalars (the default) and no compress. Otherwise incr()
+returns undef and leaves the value alone. It also returns undef if there's no space in the
+page for a new counter. Counters can't be tagged, so a counter
+created by incr() isn't removed by invalidate_tag().
+
+The I<read_cb> isn't called for keys not in the cache. The
+I<write_cb> is called with the new value in write-through mode,
+and for counters expunged in write-back mode, as for set().
+
+=cut
+sub incr {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $Delta = defined($_[2]) ? $_[2] : 1;
+  my $Initial = $_[3] || 0;
+  my $expire_seconds = defined($_[4]) ? parse_expire_time($_[4]) : -1;
+
+  # Are we doing writeback's? If so, need to mark as dirty in cache
+  my $write_back = $Self->{write_back};
+  my $write_cb = $Self->{write_cb};
+
+  # Hash, lock, expunge check, update and unlock in one call
+  my ($Val, @WBItems) = fc_incr($Cache, $_[1], $Delta, $Initial, $expire_seconds,
+    $write_back ? FC_ISDIRTY : 0, $write_back && $write_cb ? 1 : 0);
+
+  $Self->_write_back_items(@WBItems);
+
+  # If we're doing write-through, write back to the underlying store
+  if (defined($Val) && !$write_back && $write_cb) {
+    $Self->_write_through([ $_[1], $Val ]);
+  }
+
+  return $Val;
+}
+
+=item I<decr($Key, [ $Delta, $Initial, $ExpireTime ])>
+
+Atomically subtract $Delta (default 1) from the counter at $Key.
+Same as C<incr($Key, -$Delta, $Initial, $ExpireTime)>.
+
+=cut
+sub decr {
+  my $Self = shift;
+  my $Key = shift;
+  my $Delta = shift;
+  return $Self->incr($Key, -(defined($Delta) ? $Delta : 1), @_);
+}
+
+=item I<append($Key, $Data, [ $ExpireTime ])>
+
+Add $Data to the end of the value stored at $Key. If $Key isn't
+in the cache, $Data is stored as a new value, which expires after
+$ExpireTime (same format as the expire_time option to set(),
+default is the cache expire_time). Returns true if the data was
+added, false if there wasn't space or the value is a counter
+created by incr(). If the value gets too big for the page, it's
+expunged from the cache (and written back if using write_back)
+and false is returned, so the next append() starts a new value.
+A new value created by append() isn't tagged, but appending to a
+value stored with set() keeps its tags.
+
+The value is extended in place in the cache file where possible.
+When it has to be moved to make room, some spare space is kept
+after it, so a series of appends to the same key only copies the
+data being added most of the time, rather than the whole value.
+
+This only makes sense with raw_values and no compress, so dies
+otherwise. Don't mix character strings with high bit set byte
+strings in the same value, as the value is marked as a character
+string if any of the data added is one. As with set(), the
+I<write_cb> is called with the whole new value in write-through
+mode.
+
+=cut
+sub append {
+  my $Self = shift;
+  return $Self->_append(0, @_);
+}
+
+=item I<prepend($Key, $Data, [ $ExpireTime ])>
+
+Same as append(), but adds $Data to the start of the value.
+
+=cut
+sub prepend {
+  my $Self = shift;
+  return $Self->_append(1, @_);
+}
+
+=item I<touch($Key, [ $ExpireTime ])>
+
+Set $Key to expire $ExpireTime from now (same format as the
+expire_time option to set(), default is the cache expire_time),
+without changing the value. Returns true if $Key was found,
+false if it wasn't in the cache or had already expired.
+
+The expiry time is updated in place in the cache file, so this
+is much cheaper than a get() then set() to keep something like
+a session alive. The version token from get_with_version() isn't
+changed, since the value stays the same.
+
+=cut
+sub touch {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $expire_seconds = defined($_[2]) ? parse_expire_time($_[2]) : -1;
+  return fc_touch($Cache, $_[1], $expire_seconds);
+}
+
+=item I<touch_many([ $Key1, $Key2, ... ], [ $ExpireTime ])>
+
+Same as touch() for each of the given keys, locking each page
+only once. In list context, returns a list of true/false values
+in the same order as the keys, in scalar context the number of
+keys found.
+
+=cut
+sub touch_many {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $expire_seconds = defined($_[2]) ? parse_expire_time($_[2]) : -1;
+  my @Touched = fc_touch_many($Cache, $_[1], $expire_seconds);
+  return wantarray ? @Touched : scalar grep { $_ } @Touched;
+}
+
 =item I<remove($Key, [ \%Options ])>
 
-Delete the given key from the cache
+Delete the given key from the cache, including any value for it
+waiting in the I<write_behind_queue>
 
 I<%Options> is optional, and is used by get_and_remove() to control
 the locking behaviour. For now, you should probably ignore it
@@ -859,6 +1608,9 @@ sub remove {
   my ($DidDel, $Flags) = fc_delete($Cache, $HashSlot, $_[1]);
   $Unlock = undef;
 
+  # Don't write back a held back value after deleting it
+  delete $Self->{write_pending}->{$_[1]} if $Self->{write_pending};
+
   # If we deleted from the cache, and it's not dirty, also delete
   #  from underlying store
   if ((!$DidDel || ($DidDel && !($Flags & FC_ISDIRTY)))
@@ -869,6 +1621,133 @@ sub remove {
   return $DidDel;
 }
 
+=item I<keys_matching($Pattern, [ $Mode ], [ $Partition ])>
+
+Get a list of the keys in the cache matching the shell style
+$Pattern, where * matches anything, ? matches any one character,
+[...] matches one of a set of characters, and \ makes the next
+character match literally. $Mode is the same as for get_keys().
+
+  my @Keys = $Cache->keys_matching("user:123:*");
+
+The matching is done in C with each page locked once, and only
+the matching items are copied out. Keys are matched as the bytes
+they're stored as, so keys with wide characters need a pattern
+that's a character string too (see utf8::upgrade()). A pattern
+starting with plain characters (like the one above) only needs
+a memcmp() for most keys. If $Partition is
+given, only pages in it are searched (see get_keys()).
+
+=cut
+sub keys_matching {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $Mode = $_[2] || 0;
+  my @Keys = fc_match($Cache, $_[1], 0, $Mode, $Self->_partition_pages($_[3]));
+  return @Keys if $Mode <= 1;
+
+  # If we're getting values as well, and they're not raw, unfreeze them
+  return $Self->_thaw_details(@Keys);
+}
+
+=item I<remove_matching($Pattern, [ $Partition ])>
+
+Remove all items with keys matching the shell style $Pattern
+(see keys_matching()) from the cache, with each page locked once.
+Returns the number of items removed.
+
+As with remove(), the I<delete_cb> is called for each removed
+item that hasn't been changed since it was read from the
+underlying store. Keys only in the underlying store can't be
+found this way, so the I<delete_cb> isn't called for them.
+Matching items waiting in the I<write_behind_queue> are dropped
+without being written back, and aren't counted.
+
+=cut
+sub remove_matching {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my @Pages = $Self->_partition_pages($_[2]);
+
+  # Only need the removed keys for callbacks and held back writes
+  my $delete_cb = $Self->{delete_cb};
+  my $Pending = $Self->{write_pending};
+  return fc_match($Cache, $_[1], 1, -1, @Pages)
+    if !$delete_cb && !($Pending && %$Pending);
+
+  my @Items = fc_match($Cache, $_[1], 1, 1, @Pages);
+  for (@Items) {
+    delete $Pending->{$_->{key}} if $Pending;
+    next if !$delete_cb || ($_->{flags} & FC_ISDIRTY);
+    eval { $delete_cb->($Self->{context}, $_->{key}); };
+  }
+
+  return scalar @Items;
+}
+
+=item I<invalidate_namespace($Name)>
+
+Invalidate every item stored with the I<namespace> option $Name
+(see set()), by incrementing the generation counter for $Name in
+the cache file. Items written before that are treated as expired
+by all processes from then on, and their space is reclaimed as
+pages fill up, so this takes the same time however many items
+there are. Returns the new generation, or 0 if the cache was
+created without I<namespaces>.
+
+Items in other namespaces that share a counter with $Name are
+invalidated too. Generations are 32 bit counters; once every
+2^32 invalidations of a namespace, when its counter wraps round,
+each page is locked in turn to expire all its items, so none can
+become valid again.
+
+As with expired items, the I<delete_cb> isn't called for
+invalidated items. Items in the namespace waiting in the
+I<write_behind_queue> are dropped without being written back.
+
+=cut
+sub invalidate_namespace {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $NsFlags = $Self->_ns_flags($_[1]) || return 0;
+  return fc_ns_bump($Cache, $NsFlags);
+}
+
+=item I<invalidate_tag($Tag)>
+
+Remove all items stored with $Tag in their I<tags> option to set()
+or set_many() from the cache, and return the number removed. Only
+the pages whose tag references include $Tag are locked, and each
+of those just once.
+
+Tags are compared by a 32 bit hash, and items are found by the
+hash of their key, so rarely an item that wasn't tagged with
+$Tag is removed too. As with remove(), the I<delete_cb> is called
+for each removed item that hasn't been changed since it was read
+from the underlying store. Tagged items waiting in the
+I<write_behind_queue> are dropped without being written back,
+and aren't counted.
+
+=cut
+sub invalidate_tag {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Only need the removed keys for callbacks and held back writes
+  my $delete_cb = $Self->{delete_cb};
+  my $Pending = $Self->{write_pending};
+  return fc_tag_invalidate($Cache, $_[1], -1)
+    if !$delete_cb && !($Pending && %$Pending);
+
+  my @Items = fc_tag_invalidate($Cache, $_[1], 1);
+  for (@Items) {
+    delete $Pending->{$_->{key}} if $Pending;
+    next if !$delete_cb || ($_->{flags} & FC_ISDIRTY);
+    eval { $delete_cb->($Self->{context}, $_->{key}); };
+  }
+
+  return scalar @Items;
+}
+
 =item I<get_and_remove($Key)>
 
 Atomically retrieve value of a Key while removing it from the cache.
@@ -886,9 +1765,12 @@ sub get_and_remove {
   return wantarray ? ($Value, $DidDel) : $Value;
 }
 
-=item I<clear()>
+=item I<clear([ $Partition ])>
 
-Clear all items from the cache
+Clear all items from the cache, or only from the pages in
+$Partition (see get_keys())
+
+Items waiting in the I<write_behind_queue> are dropped too.
 
 Note: If you're using callbacks, this has no effect
 on items in the underlying data store. No delete
@@ -897,12 +1779,14 @@ callbacks are made
 =cut
 sub clear {
   my $Self = shift;
-  $Self->_expunge_all(1, 0);
+  $Self->_expunge_all(1, 0, $_[0]);
+  fc_queue_clear($Self->{Cache}, $Self->_partition_pages($_[0]));
 }
 
-=item I<purge()>
+=item I<purge([ $Partition ])>
 
-Clear all expired items from the cache
+Clear all expired items from the cache, or only from the
+pages in $Partition (see get_keys())
 
 Note: If you're using callbacks, this has no effect
 on items in the underlying data store. No delete
@@ -912,25 +1796,127 @@ for the expired data
 =cut
 sub purge {
   my $Self = shift;
-  $Self->_expunge_all(0, 0);
+  $Self->_expunge_all(0, 0, $_[0]);
 }
 
-=item I<empty($OnlyExpired)>
+=item I<empty($OnlyExpired, [ $Partition ])>
 
 Empty all items from the cache, or if $OnlyExpired is
-true, only expired items.
+true, only expired items. If $Partition is given, only
+the pages in it are emptied (see get_keys()).
 
 Note: If 'write_back' mode is enabled, any changed items
 are written back to the underlying store. Expired items are
-written back to the underlying store as well.
+written back to the underlying store as well. Any items waiting
+in the I<write_behind_queue> are written back too.
 
 =cut
 sub empty {
   my $Self = shift;
-  $Self->_expunge_all($_[0] ? 0 : 1, 1);
+  $Self->_expunge_all($_[0] ? 0 : 1, 1, $_[1]);
+  $Self->flush_dirty();
+}
+
+=item I<flush_dirty([ $MaxItems ], [ $MaxMs ])>
+
+Write back items waiting in the I<write_behind_queue> to the
+underlying store with the I<write_cb>, oldest first. Stops after
+$MaxItems items or $MaxMs milliseconds if given, otherwise
+carries on till the queue is empty. Returns the number of items
+written back.
+
+Items are taken from the queue in small batches, and the queue
+isn't locked while the I<write_cb> is called, so other processes
+can keep adding to it. Meant to be called regularly by a
+dedicated process:
+
+  while (1) {
+    $Cache->flush_dirty(1000, 100) or sleep 1;
+  }
+
+=cut
+sub flush_dirty {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  my ($MaxItems, $MaxMs) = @_[1, 2];
+
+  return 0 if !$Self->{write_cb} || !fc_queue_count($Cache);
+
+  my $Until = $MaxMs ? Time::HiRes::time() + $MaxMs / 1000 : undef;
+  my $Done = 0;
+  while (!$MaxItems || $Done < $MaxItems) {
+    my $Batch = $MaxItems && $MaxItems - $Done < 100 ? $MaxItems - $Done : 100;
+    my @Items = fc_queue_pop($Cache, $Batch);
+    last if !@Items;
+
+    $Self->_write_back_items(@Items);
+    $Done += @Items;
+
+    last if $Until && Time::HiRes::time() >= $Until;
+  }
+
+  return $Done;
+}
+
+=item I<flush_writes()>
+
+Write any writes held back by I<write_coalesce> to the underlying
+store now. Returns the number of items written.
+
+=cut
+sub flush_writes {
+  my $Self = shift;
+
+  my $Pending = $Self->{write_pending};
+  return 0 if !$Pending || $Self->{write_pending_pid} != $$;
+
+  my @Items = grep { $_ } map { delete $Pending->{$_} } @{$Self->{write_order}};
+  $Self->{write_order} = [];
+  %$Pending = ();
+
+  $Self->_write_items(@Items);
+  return scalar @Items;
+}
+
+=item I<checkpoint([ $Partition ])>
+
+Write back all changed items to the underlying store with the
+I<write_cb>, but keep them in the cache, marked as no longer
+changed. Items waiting in the I<write_behind_queue> are written
+back too. Returns the number of items written back. If
+$Partition is given, only items in its pages are written back
+(see get_keys()).
+
+The cache file keeps a count of the changed items in each page,
+so only pages with any are locked and searched.
+
+=cut
+sub checkpoint {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  return 0 if !$Self->{write_back} || !$Self->{write_cb};
+
+  my ($First, $End) = $Self->_partition_pages($_[1]);
+  my $Done = 0;
+  for my $Page (grep { $_ >= $First && $_ < $End } fc_dirty_pages($Cache)) {
+    my @Items = fc_clean_page($Cache, $Page);
+    $Self->_write_back_items(@Items);
+    $Done += @Items;
+  }
+
+  return $Done + $Self->flush_dirty();
 }
 
-=item I<get_keys($Mode)>
+=item I<dirty_queue_length()>
+
+Number of items waiting in the I<write_behind_queue>
+
+=cut
+sub dirty_queue_length {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  return fc_queue_count($Cache);
+}
+
+=item I<get_keys($Mode, [ $Partition ])>
 
 Get a list of keys/values held in the cache. May immediately be out of
 date because of the shared access nature of the cache
@@ -942,31 +1928,85 @@ If $Mode == 1, then an array of hashrefs, with 'key',
 
 If $Mode == 2, then hashrefs also contain 'value' key
 
+If $Partition is given, only keys from some of the pages are
+returned. It's an array ref of [ $K, $N ], which splits the
+pages into $N equal ranges, and uses range $K (0 to $N - 1).
+The same partition can be passed to cursor(), clear(), purge(),
+empty() and checkpoint(), so that a group of processes can
+each go through their own part of the cache at the same time:
+
+  for my $K (0 .. $N-1) {
+    next if fork();
+    $Cache->purge([ $K, $N ]);
+    exit(0);
+  }
+
 =cut
 sub get_keys {
   my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
 
   my $Mode = $_[1] || 0;
-  my ($Compress, $RawValues) = @$Self{qw(compress raw_values)};
-
-  return fc_get_keys($Cache, $Mode)
-    if $Mode <= 1 || ($Mode == 2 && $RawValues && !$Compress);
+  my @Keys;
+  if ($_[2]) {
+    my ($First, $End) = $Self->_partition_pages($_[2]);
+    (undef, undef, @Keys) = fc_iterate($Cache, $First, 0, $End, 2**31-1, $Mode, undef, 0);
+  } else {
+    @Keys = fc_get_keys($Cache, $Mode);
+  }
+  return @Keys if $Mode <= 1;
 
   # If we're getting values as well, and they're not raw, unfreeze them
-  my @Details = fc_get_keys($Cache, 2);
+  return $Self->_thaw_details(@Keys);
+}
 
-  for (@Details) {
-    my $Val = $_->{value};
-    if (defined $Val) {
-      $Val = Compress::Zlib::memGunzip($Val) if $Compress;
-      if (!$RawValues) {
-        $Val = eval { thaw($Val) };
-        $Val = $$Val if ref($Val);
-      }
-      $_->{value} = $Val;
-    }
+=item I<cursor([ %Options ])>
+
+Returns a cursor to go through the items in the cache a batch at a
+time, rather than getting them all at once like get_keys(). Only
+the items returned by each call are copied out of the cache, and
+each page is only locked while its items are looked at.
+
+  my $Cursor = $Cache->cursor(mode => 1, prefix => "user:");
+  while (my @Items = $Cursor->next()) {
+    ...
   }
-  return @Details;
+
+I<%Options> can contain I<mode>, the same as for get_keys() (default
+0), I<batch>, the most items each next() call returns (default 1000),
+I<prefix>, to only return keys starting with the given bytes,
+I<skip_expired>, to not return expired items, and I<partition>, to
+only go through the pages in a partition (see get_keys()). The
+I<prefix> and I<skip_expired> checks are done before any copies
+are made.
+
+$Cursor->next([ $Count ]) returns the next batch of up to $Count (or
+I<batch>) items, and an empty list once all items have been
+returned. $Cursor->position() returns a string you can pass as the
+I<position> option to a new cursor, possibly in another process, to
+carry on from where it left off.
+
+As with get_keys(), the cache may change while the cursor is being
+used. Items added or moved after the cursor has gone past them are
+missed, and items moved in a page that's part way through may be
+returned twice.
+
+=cut
+sub cursor {
+  my ($Self, %Opts) = @_;
+
+  my ($First, $End) = $Self->_partition_pages($Opts{partition});
+  my ($Page, $Slot) = split /:/, $Opts{position} || "$First:0";
+
+  return bless {
+    cache => $Self,
+    page => $Page,
+    slot => $Slot,
+    end => $End,
+    mode => $Opts{mode} || 0,
+    batch => $Opts{batch} || 1000,
+    prefix => $Opts{prefix},
+    skip_expired => $Opts{skip_expired} ? 1 : 0,
+  }, 'Cache::FastMmap::Cursor';
 }
 
 =item I<get_statistics($Clear)>
@@ -1057,8 +2097,10 @@ sub multi_get {
     next unless $Found;
 
     # If not using raw values, use thaw() to turn data back into object
-    $Val = Compress::Zlib::memGunzip($Val) if defined($Val) && $Self->{compress};
-    $Val = ${thaw($Val)} if defined($Val) && !$Self->{raw_values};
+    if (defined($Val) && !($Flags & (FC_COUNTER | FC_SCALAR))) {
+      $Val = Compress::Zlib::memGunzip($Val) if $Self->{compress};
+      $Val = ${$Self->{thaw}->($Val)} if !$Self->{raw_values};
+    }
 
     # Save to return
     $KVs{$_} = $Val;
@@ -1091,18 +2133,19 @@ sub multi_set {
   while (my ($Key, $Val) = each %$KVs) {
 
     # If not using raw values, use freeze() to turn data 
-    $Val = freeze(\$Val) unless $Self->{raw_values};
+    my $Scalar = ref($Val) ? 0 : $Self->{scalar_flag};
+    $Val = $Self->{freeze}->(\$Val) unless $Self->{raw_values} || $Scalar;
     $Val = Compress::Zlib::memGzip($Val) if $Self->{compress};
 
     # Get key/value len (we've got 'use bytes'), and do expunge check to
     #  create space if needed
     my $FinalKey = "$_[1]-$Key";
-    my $KVLen = length($FinalKey) + length($Val);
+    my $KVLen = length($FinalKey) + (defined($Val) ? length(my $Tmp = $Val) : 0);
     $Self->_expunge_page(2, 1, $KVLen);
 
     # Now hash key and store into page
     (undef, $HashSlot) = fc_hash($Cache, $FinalKey);
-    my $DidStore = fc_write($Cache, $HashSlot, $FinalKey, $Val, $expire_seconds, 0);
+    my $DidStore = fc_write($Cache, $HashSlot, $FinalKey, $Val, $expire_seconds, $Scalar);
   }
 
   # Unlock page
@@ -1111,6 +2154,112 @@ sub multi_set {
   return 1;
 }
 
+=item I<get_many([ $Key1, $Key2, ... ])>
+
+Retrieve the values for all the given keys, returned as a
+list in the same order as the keys. Keys not found in the
+cache return undef.
+
+Unlike multi_get(), the keys are normal keys, so this works
+on data stored with set(). All the keys are hashed in one
+call, and each page the keys fall in is locked only once,
+which is much quicker than calling get() for each key.
+
+The I<read_cb> is not called for keys not found in the cache, but
+if there's a I<read_many_cb>, it's called once with all of them,
+and the values it returns are stored and returned.
+
+=cut
+sub get_many {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my @Details = fc_get_many($Cache, $_[1]);
+  my ($Compress, $RawValues) = @$Self{qw(compress raw_values)};
+
+  # Look for missing keys in the write behind queue, see get()
+  if (fc_queue_count($Cache)) {
+    my @Missing = grep { !$Details[$_ * 3 + 2] } 0 .. $#{$_[1]};
+    my @Queued = @Missing ? fc_queue_get($Cache, [ @{$_[1]}[@Missing] ]) : ();
+    splice(@Details, $_ * 3, 3, splice(@Queued, 0, 3)) for @Missing;
+  }
+
+  my (@Vals, @Missing);
+  while (my ($Val, $Flags, $Found) = splice(@Details, 0, 3)) {
+
+    # If not using raw values, use thaw() to turn data back into object
+    if (defined($Val) && !($Flags & (FC_COUNTER | FC_SCALAR))) {
+      $Val = Compress::Zlib::memGunzip(my $Tmp = $Val) if $Compress;
+      $Val = ${$Self->{thaw}->($Val)} if !$RawValues;
+    }
+
+    push @Missing, scalar(@Vals) if !$Found;
+    push @Vals, $Val;
+  }
+
+  # Read all the missing keys from the underlying data store at once
+  if (@Missing && (my $read_many_cb = $Self->{read_many_cb})) {
+    my $Keys = $_[1];
+    my %Seen;
+    my @Keys = grep { !$Seen{$_}++ } @$Keys[@Missing];
+    my $Read = $read_many_cb->($Self->{context}, \@Keys) || {};
+
+    # Fill in values found, and store back into our cache
+    $Vals[$_] = $Read->{$Keys->[$_]} for @Missing;
+    @Keys = grep { defined $Read->{$_} } @Keys if !$Self->{cache_not_found};
+    $Self->_store_many(\@Keys, [ @$Read{@Keys} ], -1, 0) if @Keys;
+  }
+
+  return @Vals;
+}
+
+=item I<set_many({ $Key1 => $Value1, $Key2 => $Value2, ... }, [ \%Options ])>
+
+Store all the given key/value pairs into the cache. Returns
+the number of items that were stored.
+
+Unlike multi_set(), the keys are normal keys, so they can be
+read back with get() or get_many(). The keys are grouped by
+page, and each page is locked once and has at most one expunge
+run to make space for all the items stored in it, rather than
+one for each item.
+
+I<%Options> is the same as for set(), so you can pass an
+expire_time, namespace or tags for all the items.
+
+In 'write_through' mode, the items are written to the underlying
+store with one call to the I<write_many_cb> if given.
+
+=cut
+sub set_many {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Get opts, make compatible with Cache::Cache interface
+  my $Opts = defined($_[2]) ? (ref($_[2]) ? $_[2] : { expire_time => $_[2] }) : undef;
+  my $expire_seconds = defined($Opts && $Opts->{expire_time}) ? parse_expire_time($Opts->{expire_time}) : -1;
+
+  my $KVs = $_[1];
+  my @Keys = keys %$KVs;
+
+  # Are we doing writeback's? If so, need to mark as dirty in cache
+  my $write_back = $Self->{write_back};
+  my $write_cb = $Self->{write_cb};
+
+  my $NsFlags = $Opts && defined($Opts->{namespace}) ? $Self->_ns_flags($Opts->{namespace}) : 0;
+  my $Tags = $Opts && $Opts->{tags};
+  $Tags = [ $Tags ] if defined($Tags) && !ref($Tags);
+  my $DidStore = $Self->_store_many(\@Keys, [ @$KVs{@Keys} ], $expire_seconds,
+    ($write_back ? FC_ISDIRTY : 0) | $NsFlags, $Tags);
+
+  # If we're doing write-through, or write-back and didn't get into cache,
+  #  write back to the underlying store
+  if ($write_cb) {
+    $Self->_write_through(map { [ $Keys[$_], $KVs->{$Keys[$_]} ] }
+      grep { !$write_back || !$DidStore->[$_] } 0 .. $#Keys);
+  }
+
+  return scalar grep { $_ } @$DidStore;
+}
+
 =back
 
 =cut
@@ -1121,9 +2270,10 @@ sub multi_set {
 
 =cut
 
-=item I<_expunge_all($Mode, $WB)>
+=item I<_expunge_all($Mode, $WB, [ $Partition ])>
 
-Expunge all items from the cache
+Expunge all items from the cache, or from the pages in
+$Partition
 
 Expunged items (that have not expired) are written
 back to the underlying store if write_back is enabled
@@ -1133,7 +2283,8 @@ sub _expunge_all {
   my ($Self, $Cache, $Mode, $WB) = ($_[0], $_[0]->{Cache}, $_[1], $_[2]);
 
   # Repeat expunge for each page
-  for (0 .. $Self->{num_pages}-1) {
+  my ($First, $End) = $Self->_partition_pages($_[3]);
+  for ($First .. $End-1) {
     my $Unlock = $Self->_lock_page($_);
     $Self->_expunge_page($Mode, $WB, -1);
     $Unlock = undef;
@@ -1158,20 +2309,247 @@ sub _expunge_page {
 
   my @WBItems = fc_expunge($Cache, $Mode, $write_cb ? 1 : 0, $Len);
 
+  $Self->_write_back_items(@WBItems);
+}
+
+=item I<_write_back_items(@Items)>
+
+Call the I<write_cb> for each of the given expunged items
+(as returned by fc_expunge()) that are dirty
+
+=cut
+sub _write_back_items {
+  my $Self = shift;
+
   my ($Compress, $RawValues) = @$Self{qw(compress raw_values)};
 
-  for (@WBItems) {
+  my @Items;
+  for (@_) {
     next if !($_->{flags} & FC_ISDIRTY);
 
     my $Val = $_->{value};
-    if (defined $Val) {
+    if (defined $Val && !($_->{flags} & (FC_COUNTER | FC_SCALAR))) {
+      $Val = Compress::Zlib::memGunzip($Val) if $Compress;
+      if (!$RawValues) {
+        $Val = eval { $Self->{thaw}->($Val) };
+        $Val = $$Val if ref($Val);
+      }
+    }
+    push @Items, [ $_->{key}, $Val, $_->{expire_time} ];
+  }
+
+  $Self->_write_items(@Items);
+}
+
+=item I<_write_through(@Items)>
+
+Write the given [ $Key, $Value ] items to the underlying store
+in write through mode, or hold them back to be written later
+if I<write_coalesce> is set. Held back writes are written once
+the first one has been held back for I<write_coalesce> seconds.
+
+=cut
+sub _write_through {
+  my $Self = shift;
+
+  my $Window = $Self->{write_coalesce}
+    or return $Self->_write_items(@_);
+
+  # Held back writes from a parent process are the parent's to do
+  my $Pending = $Self->{write_pending};
+  if (!$Pending || $Self->{write_pending_pid} != $$) {
+    $Pending = $Self->{write_pending} = {};
+    $Self->{write_pending_pid} = $$;
+  }
+
+  my $Now = Time::HiRes::time();
+  $Self->{write_due} = $Now + $Window if !%$Pending;
+
+  # Keep the first position of each key but the latest value
+  for (@_) {
+    push @{$Self->{write_order}}, $_->[0] if !$Pending->{$_->[0]};
+    $Pending->{$_->[0]} = $_;
+  }
+
+  $Self->flush_writes() if $Now >= $Self->{write_due};
+}
+
+=item I<_write_items(@Items)>
+
+Write the given [ $Key, $Value, $ExpiryTime ] items to the
+underlying store, with one call to the I<write_many_cb> if
+there's more than one and it's set, otherwise with the
+I<write_cb> for each one
+
+=cut
+sub _write_items {
+  my $Self = shift;
+  return if !@_;
+
+  if (@_ > 1 && (my $write_many_cb = $Self->{write_many_cb})) {
+    eval { $write_many_cb->($Self->{context}, [ @_ ]); };
+    return;
+  }
+
+  my $write_cb = $Self->{write_cb};
+  eval { $write_cb->($Self->{context}, @$_); } for @_;
+}
+
+=item I<_partition_pages($Partition)>
+
+Return the first page and the page after the last page of the
+given [ $K, $N ] partition, or of the whole cache if undef
+
+=cut
+sub _partition_pages {
+  my ($Self, $Partition) = @_;
+
+  my $NumPages = $Self->{num_pages};
+  return (0, $NumPages) if !$Partition;
+
+  my ($K, $N) = @$Partition;
+  $N >= 1 && $K >= 0 && $K < $N
+    or die "Invalid partition [ $K, $N ]";
+
+  return (int($K * $NumPages / $N), int(($K + 1) * $NumPages / $N));
+}
+
+=item I<_ns_flags($Name)>
+
+Return the item flags for namespace $Name, which are remembered
+for each name after the first call
+
+=cut
+sub _ns_flags {
+  my ($Self, $Name) = @_;
+
+  return $Self->{ns_flags}->{$Name} ||= fc_ns_flags($Self->{Cache}, $Name);
+}
+
+=item I<_thaw_details(@Details)>
+
+Unfreeze the values of the given mode 2 get_keys() items if
+they're not raw, and return them
+
+=cut
+sub _thaw_details {
+  my $Self = shift;
+
+  my ($Compress, $RawValues) = @$Self{qw(compress raw_values)};
+  return @_ if $RawValues && !$Compress;
+
+  for (@_) {
+    my $Val = $_->{value};
+    if (defined $Val && !($_->{flags} & (FC_COUNTER | FC_SCALAR))) {
       $Val = Compress::Zlib::memGunzip($Val) if $Compress;
       if (!$RawValues) {
-        $Val = eval { thaw($Val) };
+        $Val = eval { $Self->{thaw}->($Val) };
         $Val = $$Val if ref($Val);
       }
+      $_->{value} = $Val;
     }
-    eval { $write_cb->($Self->{context}, $_->{key}, $Val, $_->{expire_time}); };
+  }
+  return @_;
+}
+
+=item I<_append($Prepend, $Key, $Data, $ExpireTime)>
+
+Implementation of append() and prepend()
+
+=cut
+sub _append {
+  my ($Self, $Cache, $Prepend) = ($_[0], $_[0]->{Cache}, $_[1]);
+
+  !$Self->{raw_values} || $Self->{compress}
+    and die "append() and prepend() need raw_values and no compress";
+
+  my $expire_seconds = defined($_[4]) ? parse_expire_time($_[4]) : -1;
+
+  # Are we doing writeback's? If so, need to mark as dirty in cache
+  my $write_back = $Self->{write_back};
+  my $write_cb = $Self->{write_cb};
+
+  # Hash, lock, expunge check, append and unlock in one call
+  my ($Res, @WBItems) = fc_append($Cache, $_[2], $_[3], $Prepend, $expire_seconds,
+    $write_back ? FC_ISDIRTY : 0, $write_back && $write_cb ? 1 : 0);
+  $Self->_write_back_items(@WBItems);
+
+  # If we're doing write-through, write back to the underlying store
+  if ($Res > 0 && !$write_back && $write_cb) {
+    $Self->_write_through([ $_[2], $Self->get($_[2]) ]);
+  }
+
+  return $Res > 0 ? 1 : 0;
+}
+
+=item I<_store_many(\@Keys, \@Vals, $ExpireSeconds, $Flags, [ \@Tags ])>
+
+Freeze/compress the values and store them with one lock of each
+page, writing back any dirty items expunged to make space. Each
+item is referenced from the tag index for any @Tags.
+Returns an array ref of whether each item was stored.
+
+=cut
+sub _store_many {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # If not using raw values, use freeze() to turn data. Plain scalars
+  #  are stored as they are, so frozen values are passed as references
+  #  to tell them apart
+  my @Vals = @{$_[2]};
+  my $Scalar = $Self->{scalar_flag};
+  if (!$Self->{raw_values}) {
+    my $freeze = $Self->{freeze};
+    @Vals = $Scalar
+      ? map { ref($_) ? \$freeze->(\$_) : $_ } @Vals
+      : map { $freeze->(\$_) } @Vals;
+  }
+  @Vals = map { Compress::Zlib::memGzip($_) } @Vals if $Self->{compress};
+
+  # Expunge, store and unlock each page in one call
+  my $WB = $Self->{write_back} && $Self->{write_cb} ? 1 : 0;
+  my ($DidStore, @WBItems) = fc_set_many($Cache, $_[1], \@Vals, $_[3], $_[4] | $Scalar, $WB, -1, $_[5]);
+
+  $Self->_write_back_items(@WBItems);
+
+  return $DidStore;
+}
+
+=item I<_take_lease($HashPage, $HashSlot, $Key, $Unlock)>
+
+Called from get() with $HashPage locked (by $Unlock) when $Key
+isn't in the cache. Tries to take the read lease on $Key. If
+another process has it, unlocks the page and waits for up to
+read_lease_wait seconds for the value to appear.
+
+Returns a list of whether this process should call the read_cb
+(having taken the lease, or given up waiting), and the value,
+flags and found result of the last read. The page is locked
+again on return
+
+=cut
+sub _take_lease {
+  my ($Self, $Cache, $HashPage, $HashSlot) = ($_[0], $_[0]->{Cache}, $_[1], $_[2]);
+
+  my $WaitUntil = time() + $Self->{read_lease_wait};
+  while (1) {
+
+    # Make space for the placeholder and try to take lease. If
+    #  it couldn't be stored, just carry on without it
+    $Self->_expunge_page(2, 1, length($_[3]));
+    my $Res = fc_lease($Cache, $HashSlot, $_[3], $Self->{read_lease});
+    return (1, undef, 0, 0) if $Res != 0;
+
+    # Someone else has it, wait a bit and see if the value is there
+    $_[4] = undef;
+    select(undef, undef, undef, 0.01);
+    $_[4] = $Self->_lock_page($HashPage);
+
+    my ($Val, $Flags, $Found) = fc_read($Cache, $HashSlot, $_[3]);
+    return (0, $Val, $Flags, $Found) if $Found;
+
+    # Waited long enough, do it ourselves
+    return (0, undef, 0, 0) if time() >= $WaitUntil;
   }
 }
 
@@ -1205,6 +2583,9 @@ sub cleanup {
   return if $Self->{cleaned};
   $Self->{cleaned} = 1;
 
+  # Write any held back writes from this process
+  $Self->flush_writes() if $Self->{write_pending};
+
   # Expunge all entries on exit if requested and in parent process
   if ($Self->{empty_on_exit} && $Cache && $Self->{pid} == $$) {
     $Self->empty();
@@ -1241,6 +2622,32 @@ sub CLONE {
 
 1;
 
+package Cache::FastMmap::Cursor;
+use strict;
+
+# Cursor returned by Cache::FastMmap::cursor()
+
+sub next {
+  my ($Cursor, $Count) = @_;
+  my $Self = $Cursor->{cache};
+
+  return () if $Cursor->{page} >= $Cursor->{end};
+
+  my ($Page, $Slot, @Items) = Cache::FastMmap::fc_iterate($Self->{Cache},
+    @$Cursor{qw(page slot end)}, $Count || $Cursor->{batch},
+    @$Cursor{qw(mode prefix skip_expired)});
+  @$Cursor{qw(page slot)} = ($Page, $Slot);
+
+  return $Cursor->{mode} == 2 ? $Self->_thaw_details(@Items) : @Items;
+}
+
+sub position {
+  my $Cursor = shift;
+  return "$Cursor->{page}:$Cursor->{slot}";
+}
+
+1;
+
 package Cache::FastMmap::OnLeave;
 use strict;
 
@@ -1350,6 +2757,22 @@ option passed to new.
 
 =back
 
+=item * From 1.41
+
+=over 4
+
+=item *
+
+The layout of the cache file has changed to store a version for
+each item (see get_with_version()), spare space reserved after
+values for append(), a soft expiry time, the time taken to
+calculate the value and a bloom filter in each page. A cache
+file created by an earlier version can't be used, so make sure
+any existing file is recreated by passing init_file => 1 (or
+test_file => 1).
+
+=back
+
 =back
 
 =cut
@@ -19,6 +19,7 @@
 #include <time.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <math.h>
 #include "mmap_cache.h"
 #include "mmap_cache_internals.h"
 
@@ -48,9 +49,19 @@ mmap_cache * mmc_new() {
   cache->c_num_pages = def_c_num_pages;
   cache->c_page_size = def_c_page_size;
   cache->c_size = 0;
+  cache->c_queue_size = 0;
+  cache->c_queue_offset = 0;
+  cache->c_num_ns = 0;
+  cache->c_ns_offset = 0;
+  cache->c_tag_slots = 0;
+  cache->c_tag_offset = 0;
 
   cache->start_slots = def_start_slots;
   cache->expire_time = def_expire_time;
+  cache->soft_expire_time = 0;
+  cache->expire_jitter = 0;
+  cache->early_expire_beta = 0;
+  cache->c_rand = (MU32)time(0) ^ (MU32)(size_t)cache;
 
   cache->fh = 0;
   cache->share_file = _mmc_get_def_share_filename(cache);
@@ -76,6 +87,18 @@ int mmc_set_param(mmap_cache * cache, char * param, char * val) {
     cache->c_num_pages = atoi(val);
   } else if (!strcmp(param, "expire_time")) {
     cache->expire_time = atoi(val);
+  } else if (!strcmp(param, "soft_expire_time")) {
+    cache->soft_expire_time = atoi(val);
+  } else if (!strcmp(param, "queue_size")) {
+    cache->c_queue_size = atoi(val);
+  } else if (!strcmp(param, "namespaces")) {
+    cache->c_num_ns = atoi(val);
+  } else if (!strcmp(param, "tag_slots")) {
+    cache->c_tag_slots = atoi(val);
+  } else if (!strcmp(param, "expire_jitter")) {
+    cache->expire_jitter = atoi(val);
+  } else if (!strcmp(param, "early_expire_beta")) {
+    cache->early_expire_beta = atoi(val);
   } else if (!strcmp(param, "share_file")) {
     cache->share_file = val;
   } else if (!strcmp(param, "start_slots")) {
@@ -99,6 +122,18 @@ int mmc_get_param(mmap_cache * cache, char * param) {
     return (int)cache->c_num_pages;
   } else if (!strcmp(param, "expire_time")) {
     return (int)cache->expire_time;
+  } else if (!strcmp(param, "soft_expire_time")) {
+    return (int)cache->soft_expire_time;
+  } else if (!strcmp(param, "queue_size")) {
+    return (int)cache->c_queue_size;
+  } else if (!strcmp(param, "namespaces")) {
+    return (int)cache->c_num_ns;
+  } else if (!strcmp(param, "tag_slots")) {
+    return (int)cache->c_tag_slots;
+  } else if (!strcmp(param, "expire_jitter")) {
+    return (int)cache->expire_jitter;
+  } else if (!strcmp(param, "early_expire_beta")) {
+    return (int)cache->early_expire_beta;
   } else {
     _mmc_set_error(cache, 0, "Bad set_param parameter: %s", param);
     return -1;
@@ -134,6 +169,37 @@ int mmc_init(mmap_cache * cache) {
 
   cache->c_size = c_size = c_num_pages * c_page_size;
 
+  /* Dirty item counts go after the pages */
+  cache->c_dirty_offset = c_size;
+  cache->c_size = c_size = c_size + c_num_pages * 4;
+
+  /* Write behind queue after that */
+  if (cache->c_queue_size) {
+    cache->c_queue_size = (cache->c_queue_size + 3) & ~3;
+    if (cache->c_queue_size < 1024) cache->c_queue_size = 1024;
+    cache->c_queue_offset = c_size;
+    cache->c_size = c_size = c_size + cache->c_queue_size;
+  }
+
+  /* Namespace generations after that, at most as many as fit in
+   * the entry flags */
+  if (cache->c_num_ns) {
+    if (cache->c_num_ns > (MMC_NS_MASK >> MMC_NS_SHIFT))
+      cache->c_num_ns = MMC_NS_MASK >> MMC_NS_SHIFT;
+    cache->c_ns_offset = c_size;
+    cache->c_size = c_size = c_size + cache->c_num_ns * 4;
+  }
+
+  /* Tag index for each page after that */
+  if (cache->c_tag_slots) {
+    cache->c_tag_offset = c_size;
+    cache->c_size = c_size = c_size + cache->c_num_pages * T_SegSize(cache);
+  }
+
+  /* Bloom filter has one bit for every 32 bytes of page */
+  cache->c_bloom_words = c_page_size / 1024;
+  if (cache->c_bloom_words < 1) cache->c_bloom_words = 1;
+
   if ( mmc_open_cache_file(cache, &do_init) == -1) return -1;
 
   /* Map file into memory */
@@ -181,6 +247,15 @@ int mmc_init(mmap_cache * cache) {
     }
   }
 
+  /* Setup write behind queue if new, or not valid */
+  if (cache->c_queue_size) {
+    void * q_ptr = Q_Base(cache);
+    if (mmc_queue_lock(cache)) return -1;
+    if (do_init || Q_Magic(q_ptr) != Q_MAGIC || Q_Size(q_ptr) != cache->c_queue_size - Q_HEADERSIZE - Q_BloomLen(cache))
+      _mmc_init_queue(cache);
+    mmc_queue_unlock(cache);
+  }
+
   return 0;
 }
 
@@ -231,6 +306,29 @@ char * mmc_error(mmap_cache * cache) {
   return "Unknown error";
 }
 
+/*
+ * int mmc_bloom_check(
+ *   cache_mmap * cache, MU32 hash_page, MU32 hash_slot
+ * )
+ *
+ * Check the bloom filter of the given page, without locking it.
+ * If it returns 0, the key isn't in the page, so there's no need
+ * to lock the page and read. Otherwise it might be. Always
+ * returns 1 if stats are enabled, since reads have to be counted
+ *
+*/
+int mmc_bloom_check(mmap_cache * cache, MU32 hash_page, MU32 hash_slot) {
+  volatile MU32 * bloom;
+  MU32 bits;
+
+  if (cache->enable_stats || hash_page >= cache->c_num_pages)
+    return 1;
+
+  bloom = P_Bloom(PTR_ADD(cache->mm_var, hash_page * cache->c_page_size));
+  bits = cache->c_bloom_words * 32;
+  return BLOOM_TEST(bloom, BLOOM_H1(hash_slot, bits)) && BLOOM_TEST(bloom, BLOOM_H2(hash_slot, bits)) ? 1 : 0;
+}
+
 /*
  * mmc_lock(
  *   cache_mmap * cache, MU32 p_cur
@@ -258,7 +356,7 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
 
   if (mmc_lock_page(cache, p_offset) == -1) return -1;
 
-  if (!(P_Magic(p_ptr) == 0x92f7e3b1))
+  if (!(P_Magic(p_ptr) == P_MAGIC))
     return -1 + _mmc_set_error(cache, 0, "magic page start marker not found. p_cur is %u, offset is %u", p_cur, p_offset);
 
   /* Copy to cache structure */
@@ -269,6 +367,8 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
   cache->p_free_bytes = P_FreeBytes(p_ptr);
   cache->p_n_reads = P_NReads(p_ptr);
   cache->p_n_read_hits = P_NReadHits(p_ptr);
+  cache->p_cas = P_Cas(p_ptr);
+  cache->p_n_dirty = D_Count(cache, p_cur);
 
   /* Reality check */
   if (cache->p_num_slots < 89 || cache->p_num_slots > cache->c_page_size)
@@ -281,7 +381,7 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
     return -1 + _mmc_set_error(cache, 0, "cache free data mistmatch");
 
   /* Check page header */
-  ASSERT(P_Magic(p_ptr) == 0x92f7e3b1);
+  ASSERT(P_Magic(p_ptr) == P_MAGIC);
   ASSERT(P_NumSlots(p_ptr) >= 89 && P_NumSlots(p_ptr) < cache->c_page_size);
   ASSERT(P_FreeSlots(p_ptr) >= 0 && P_FreeSlots(p_ptr) <= P_NumSlots(p_ptr));
   ASSERT(P_OldSlots(p_ptr) <= P_FreeSlots(p_ptr));
@@ -291,7 +391,7 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
   cache->p_cur = p_cur;
   cache->p_offset = p_cur * cache->c_page_size;
   cache->p_base = p_ptr;
-  cache->p_base_slots = PTR_ADD(p_ptr, P_HEADERSIZE);
+  cache->p_base_slots = PTR_ADD(p_ptr, P_HeaderSize(cache));
 
   ASSERT(_mmc_test_page(cache));
 
@@ -322,6 +422,8 @@ int mmc_unlock(mmap_cache * cache) {
     P_FreeBytes(p_ptr) = cache->p_free_bytes;
     P_NReads(p_ptr) = cache->p_n_reads;
     P_NReadHits(p_ptr) = cache->p_n_read_hits;
+    P_Cas(p_ptr) = cache->p_cas;
+    D_Count(cache, cache->p_cur) = cache->p_n_dirty;
   }
 
   /* Test before unlocking */
@@ -391,6 +493,29 @@ int mmc_read(
   void *key_ptr, int key_len,
   void **val_ptr, int *val_len,
   MU32 *flags
+) {
+  return mmc_read_cas(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, flags, 0);
+}
+
+/*
+ * int mmc_read_cas(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void **val_ptr, int *val_len,
+ *   MU32 *flags, MU32 *cas
+ * )
+ *
+ * Read key from current page, and also return the CAS value of
+ * the item if cas is non-null. Pass the CAS value to
+ * mmc_check_cas() before writing to only write if the item hasn't
+ * changed since
+ *
+*/
+int mmc_read_cas(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void **val_ptr, int *val_len,
+  MU32 *flags, MU32 *cas
 ) {
   MU32 * slot_ptr;
 
@@ -415,13 +540,11 @@ int mmc_read(
     MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
     MU32 now = (MU32)time(0);
 
-    MU32 expire_time = S_ExpireTime(base_det);
-
     /* Sanity check hash matches */
     ASSERT(S_SlotHash(base_det) == hash_slot);
 
     /* Value expired? */
-    if (expire_time && now > expire_time) {
+    if (S_IsExpired(cache, base_det, now)) {
 
       /* Delete slot and return not found */
       _mmc_delete_slot(cache, slot_ptr);
@@ -430,13 +553,23 @@ int mmc_read(
       return -1;
     }
 
+    /* Lease placeholders aren't values */
+    if (S_Flags(base_det) & MMC_LEASE)
+      return -1;
+
     /* Update hit time */
     S_LastAccess(base_det) = now;
 
     /* Copy values to pointers */
-    *flags = S_Flags(base_det);
+    *flags = S_Flags(base_det) & ~MMC_REFRESHING;
+    if (S_IsStale(base_det, now))
+      *flags |= MMC_STALE;
+    if (cache->early_expire_beta && _mmc_early_expire(cache, base_det, now))
+      *flags |= MMC_EARLY;
     *val_len = S_ValLen(base_det);
     *val_ptr = S_ValPtr(base_det);
+    if (cas)
+      *cas = S_Cas(base_det);
 
     /* Increase read hit count */
     if (cache->enable_stats)
@@ -446,6 +579,168 @@ int mmc_read(
   }
 }
 
+/*
+ * int mmc_read_stream(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   mmc_read_fn read_fn, void * ctx
+ * )
+ *
+ * Read key from current page, and pass a pointer to the value
+ * data straight to read_fn, so it can be written out without
+ * copying it first. The page must stay locked while read_fn runs.
+ *
+ * Returns -1 if not found, otherwise the return value of read_fn
+ *
+*/
+int mmc_read_stream(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  mmc_read_fn read_fn, void * ctx
+) {
+  void * val_ptr;
+  int val_len;
+  MU32 flags;
+
+  if (mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &flags) == -1)
+    return -1;
+
+  return read_fn(ctx, val_ptr, val_len, flags);
+}
+
+/*
+ * int mmc_read_copy(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *buf, int buf_len, int *val_len,
+ *   MU32 *flags
+ * )
+ *
+ * Read key from current page, and copy the value into the
+ * callers buffer of buf_len bytes. val_len is set to the full
+ * length of the value, even if only part of it fits in buf
+ *
+ * Returns -1 if not found, 1 if the value was truncated to
+ * fit in buf, 0 otherwise
+ *
+*/
+int mmc_read_copy(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *buf, int buf_len, int *val_len,
+  MU32 *flags
+) {
+  void * val_ptr;
+
+  if (mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, val_len, flags) == -1)
+    return -1;
+
+  if (*val_len > buf_len) {
+    memcpy(buf, val_ptr, buf_len);
+    return 1;
+  }
+
+  memcpy(buf, val_ptr, *val_len);
+  return 0;
+}
+
+/*
+ * int mmc_read_range(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   int offset, int len,
+ *   void **ptr, int *val_len,
+ *   MU32 *flags
+ * )
+ *
+ * Read key from current page, and set ptr to the part of the
+ * value data starting at offset, so the caller only has to copy
+ * the part it needs. A negative offset counts back from the end
+ * of the value, and a negative len means to the end of the value.
+ * The range is clipped to the value. val_len is set to the full
+ * length of the value
+ *
+ * Returns -1 if not found, otherwise the length of the range
+ *
+*/
+int mmc_read_range(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  int offset, int len,
+  void **ptr, int *val_len,
+  MU32 *flags
+) {
+  void * val_ptr;
+
+  if (mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, val_len, flags) == -1)
+    return -1;
+
+  len = mmc_clip_range(*val_len, &offset, len);
+
+  *ptr = PTR_ADD(val_ptr, offset);
+  return len;
+}
+
+/*
+ * int mmc_clip_range(int total_len, int *offset, int len)
+ *
+ * Clip a range as for mmc_read_range() to data of total_len
+ * bytes. offset is updated to the clipped start of the range
+ *
+ * Returns the clipped length of the range
+ *
+*/
+int mmc_clip_range(int total_len, int *offset, int len) {
+  if (*offset < 0) {
+    *offset += total_len;
+    if (*offset < 0) *offset = 0;
+  }
+  if (*offset > total_len)
+    *offset = total_len;
+  if (len < 0 || len > total_len - *offset)
+    len = total_len - *offset;
+
+  return len;
+}
+
+/*
+ * int mmc_exists(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 *expire_time, int *val_len
+ * )
+ *
+ * Check if key exists in current page and hasn't expired. Sets
+ * the expire time and value length of the item if found. Unlike
+ * mmc_read(), doesn't count as a read or access of the item, and
+ * doesn't change the page at all
+ *
+ * Returns 1 if found, 0 if not
+ *
+*/
+int mmc_exists(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 *expire_time, int *val_len
+) {
+  MU32 * base_det;
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (!slot_ptr || *slot_ptr <= 1)
+    return 0;
+
+  base_det = S_Ptr(cache->p_base, *slot_ptr);
+  if (S_IsExpired(cache, base_det, (MU32)time(0)))
+    return 0;
+  if (S_Flags(base_det) & MMC_LEASE)
+    return 0;
+
+  *expire_time = S_ExpireTime(base_det);
+  *val_len = (int)S_ValLen(base_det);
+
+  return 1;
+}
+
 /*
  * int mmc_write(
  *   cache_mmap * cache, MU32 hash_slot,
@@ -462,12 +757,46 @@ int mmc_write(
   void *key_ptr, int key_len,
   void *val_ptr, int val_len,
   MU32 expire_seconds, MU32 flags
+) {
+  return mmc_write_ext(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_seconds, (MU32)-1, 0, flags);
+}
+
+/*
+ * int mmc_write_ext(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len,
+ *   MU32 expire_seconds, MU32 soft_seconds,
+ *   MU32 recompute_ms, MU32 flags
+ * )
+ *
+ * Write key to current page, with the value becoming stale after
+ * soft_seconds. As for expire_seconds, 0 means never and -1 means
+ * use the cache default. recompute_ms is how long the value took
+ * to calculate, used to decide when to expire it early
+ *
+ * If the cache has an expire_jitter set, expiry times are reduced
+ * by a random amount up to that percentage
+ *
+*/
+int mmc_write_ext(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_seconds, MU32 soft_seconds,
+  MU32 recompute_ms, MU32 flags
 ) {
   int did_store = 0;
-  MU32 kvlen = KV_SlotLen(key_len, val_len);
+  MU32 kvlen, * slot_ptr;
+
+  /* Only items that can become stale store a soft expiry time */
+  if (soft_seconds == (MU32)-1) soft_seconds = cache->soft_expire_time;
+  flags = (flags & MMC_NS_MASK) | (flags & ~MMC_LAYOUT_FLAGS) | _mmc_recompute_bits(recompute_ms);
+  if (soft_seconds) flags |= MMC_SOFT;
+  kvlen = KV_SlotLen(flags, key_len, val_len);
 
   /* Search for slot with given key */
-  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 1);
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 1);
 
   /* If all slots full, definitely can't store */
   if (!slot_ptr)
@@ -495,13 +824,29 @@ int mmc_write(
     if (expire_seconds == (MU32)-1) expire_seconds = cache->expire_time;
     expire_time = expire_seconds ? now + expire_seconds : 0;
 
+    /* Spread out expiry of items written at the same time */
+    if (cache->expire_jitter && !(flags & MMC_LEASE)) {
+      expire_time = expire_seconds ? now + _mmc_jitter(cache, expire_seconds) : 0;
+      soft_seconds = _mmc_jitter(cache, soft_seconds);
+    }
+
     /* Store info into slot */
     S_LastAccess(base_det) = now;
     S_ExpireTime(base_det) = expire_time;
     S_SlotHash(base_det) = hash_slot;
     S_Flags(base_det) = flags;
+    if (flags & MMC_DIRTY) cache->p_n_dirty++;
     S_KeyLen(base_det) = (MU32)key_len;
     S_ValLen(base_det) = (MU32)val_len;
+    if (flags & MMC_SOFT)
+      S_SoftExpire(base_det) = now + soft_seconds;
+    if (flags & MMC_NS_MASK) {
+      MU32 ns_id = S_NsId(base_det);
+      S_NsGen(base_det) = ns_id <= cache->c_num_ns ? NS_Gen(cache, ns_id) : 0;
+    }
+    BLOOM_SET(P_Bloom(cache->p_base), BLOOM_H1(hash_slot, cache->c_bloom_words * 32));
+    BLOOM_SET(P_Bloom(cache->p_base), BLOOM_H2(hash_slot, cache->c_bloom_words * 32));
+    CAS_Next(cache, base_det);
 
     /* Copy key/value to data section */
     memcpy(S_KeyPtr(base_det), key_ptr, key_len);
@@ -527,6 +872,167 @@ int mmc_write(
   return did_store;
 }
 
+/*
+ * int mmc_check_cas(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 cas
+ * )
+ *
+ * Check if the CAS value of the current item for key in the
+ * current page still matches cas. A cas of 0 matches only if
+ * there's no current item for key
+ *
+ * Returns 1 if it matches, 0 if not
+ *
+*/
+int mmc_check_cas(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 cas
+) {
+  MU32 cur_cas = 0;
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  /* Expired items and leases count as not there */
+  if (slot_ptr && *slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+
+    if (!(S_Flags(base_det) & MMC_LEASE) && !S_IsExpired(cache, base_det, (MU32)time(0)))
+      cur_cas = S_Cas(base_det);
+  }
+
+  return cur_cas == cas;
+}
+
+/*
+ * int mmc_append(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *data_ptr, int data_len, int mode,
+ *   MU32 expire_seconds, MU32 flags,
+ *   int *val_len
+ * )
+ *
+ * Add data to the end (or start if mode has MMC_PREPEND) of the
+ * value for key in the current page. The value is grown in place if it
+ * has enough slack space reserved after it, or is the last item
+ * in the data area. Otherwise it's moved once to the free data
+ * area with slack for later appends, so repeated appends only
+ * copy the new data most of the time. If there's no value for key,
+ * a new one is written with the given expiry, unless mode has
+ * MMC_EXISTING. flags are or'ed into
+ * the item flags, or replace them if the value was empty
+ *
+ * val_len is set to the new length of the value, or the length
+ * it needs if there wasn't space
+ *
+ * Returns 1 if done, 0 if there wasn't space, -1 if the value is
+ * a counter, -2 if there's no value and MMC_EXISTING was passed
+ *
+*/
+int mmc_append(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *data_ptr, int data_len, int mode,
+  MU32 expire_seconds, MU32 flags,
+  int *val_len
+) {
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+  MU32 * base_det, * new_det;
+  MU32 now = (MU32)time(0), old_len, new_len, slot_len, kvlen, slack;
+
+  if (slot_ptr && *slot_ptr > 1) {
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+
+    /* Expired values and leases are just replaced */
+    if (S_IsExpired(cache, base_det, now) || (S_Flags(base_det) & MMC_LEASE))
+      _mmc_delete_slot(cache, slot_ptr);
+    else
+      goto found;
+  }
+
+  /* Nothing there, write new value */
+  *val_len = data_len;
+  if (mode & MMC_EXISTING)
+    return -2;
+  return mmc_write(cache, hash_slot, key_ptr, key_len, data_ptr, data_len, expire_seconds, flags);
+
+found:
+  if (S_Flags(base_det) & MMC_COUNTER)
+    return -1;
+
+  old_len = S_ValLen(base_det);
+  new_len = old_len + data_len;
+  *val_len = (int)new_len;
+
+  /* Keep item from being expunged while we make space for it */
+  S_LastAccess(base_det) = now;
+
+  slot_len = S_SlotLen(base_det);
+  ROUNDLEN(slot_len);
+  slack = S_Slack(base_det);
+
+  /* Enough slack, or last item and enough free space, grow in place */
+  if (slack >= (MU32)data_len) {
+    slack -= data_len;
+
+  } else if (*slot_ptr + slot_len == cache->p_free_data) {
+    kvlen = KV_SlotLen(S_Flags(base_det), key_len, new_len);
+    ROUNDLEN(kvlen);
+    if (kvlen - slot_len > cache->p_free_bytes)
+      return 0;
+
+    slack = 0;
+    cache->p_free_data += kvlen - slot_len;
+    cache->p_free_bytes -= kvlen - slot_len;
+
+  /* Otherwise move to the free data area with slack of half the size */
+  } else {
+    kvlen = KV_SlotLen(S_Flags(base_det), key_len, new_len);
+    slot_len = kvlen + new_len / 2;
+    ROUNDLEN(kvlen);
+    ROUNDLEN(slot_len);
+    if (kvlen > cache->p_free_bytes)
+      return 0;
+
+    /* Use whatever is free if not enough for all the slack */
+    if (slot_len > cache->p_free_bytes)
+      slot_len = cache->p_free_bytes;
+    slack = slot_len - KV_SlotLen(S_Flags(base_det), key_len, new_len);
+
+    new_det = PTR_ADD(cache->p_base, cache->p_free_data);
+    memcpy(new_det, base_det, KV_SlotLen(S_Flags(base_det), key_len, old_len));
+
+    *slot_ptr = cache->p_free_data;
+    cache->p_free_data += slot_len;
+    cache->p_free_bytes -= slot_len;
+
+    base_det = new_det;
+  }
+
+  /* Add the new data */
+  if (mode & MMC_PREPEND) {
+    memmove(PTR_ADD(S_ValPtr(base_det), data_len), S_ValPtr(base_det), old_len);
+    memcpy(S_ValPtr(base_det), data_ptr, data_len);
+  } else {
+    memcpy(PTR_ADD(S_ValPtr(base_det), old_len), data_ptr, data_len);
+  }
+  S_ValLen(base_det) = new_len;
+
+  /* Flags of an empty value don't describe anything, so replace them */
+  flags &= ~MMC_LAYOUT_FLAGS;
+  _mmc_set_flags(cache, base_det, old_len ? S_Flags(base_det) | flags : (S_Flags(base_det) & MMC_LAYOUT_FLAGS) | flags);
+
+  /* Record what's left of the slack after the new value */
+  _mmc_set_slack(base_det, slack);
+
+  CAS_Next(cache, base_det);
+  cache->p_changed = 1;
+
+  return 1;
+}
+
 /*
  * int mmc_delete(
  *   cache_mmap * cache, MU32 hash_slot,
@@ -555,7 +1061,7 @@ int mmc_delete(
 
     /* Store flags in output pointer */
     MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
-    *flags = S_Flags(base_det);
+    *flags = S_Flags(base_det) & ~MMC_REFRESHING;
 
     _mmc_delete_slot(cache, slot_ptr);
     return 1;
@@ -563,58 +1069,334 @@ int mmc_delete(
 
 }
 
-int last_access_cmp(const void * a, const void * b) {
-  MU32 av = S_LastAccess(*(MU32 **)a);
-  MU32 bv = S_LastAccess(*(MU32 **)b);
-  if (av < bv) return -1;
-  if (av > bv) return 1;
-  return 0;
-}
-
 /*
- * int mmc_calc_expunge(
- *   cache_mmap * cache, int mode, int len, MU32 * new_num_slots, MU32 *** to_expunge
+ * int mmc_incr(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MI64 delta, MI64 initial,
+ *   MU32 expire_seconds, MU32 flags,
+ *   MI64 *result
  * )
  *
- * Calculate entries to expunge from current page.
- *
- *  If len >= 0
- *    If space available for len bytes & >30% slots free, nothing is expunged
- *  If len < 0 or not above
- *    If mode == 0, only expired items are expunged
- *    If mode == 1, all entries are expunged
- *    If mode == 2, entries are expunged till 40% free space is created
- *    
- * If expunged is non-null pointer, result is filled with
- * a list of slots to expunge
+ * Add delta to the counter for key in the current page. Existing
+ * counters are updated in place, so no new data space is used. If
+ * there's no entry for key, a new counter of initial + delta is
+ * stored with the given expiry. Native integers (MMC_IVVAL) are
+ * converted to counters in place, and other existing entries if
+ * their value is a decimal integer string, keeping their expiry
+ * time. flags are or'ed into the entry flags
  *
- * Return value is number of items to expunge
+ * Returns 0 if done, -1 if the existing value isn't an integer
+ * or doesn't fit in 64 bits, -2 if there wasn't space to store a
+ * new counter
  *
 */
-int mmc_calc_expunge(
-  mmap_cache * cache,
-  int mode, int len,
-  MU32 * new_num_slots, MU32 *** to_expunge
+int mmc_incr(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MI64 delta, MI64 initial,
+  MU32 expire_seconds, MU32 flags,
+  MI64 *result
 ) {
-  double slots_pct;
+  MI64 value = initial;
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
 
-  ASSERT(cache->p_cur != -1);
+  if (slot_ptr && *slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+    MU32 now = (MU32)time(0);
+    MU32 expire_time = S_ExpireTime(base_det);
 
-  /* If len >= 0, and space available for len bytes, nothing is expunged */
-  if (len >= 0) {
-    /* Length of key/value data when stored */
-    MU32 kvlen = KV_SlotLen(len, 0);
-    ROUNDLEN(kvlen);
+    /* Expired values and leases are just replaced by a new counter */
+    if (S_IsExpired(cache, base_det, now) || (S_Flags(base_det) & MMC_LEASE)) {
+      _mmc_delete_slot(cache, slot_ptr);
 
-    slots_pct = (double)(cache->p_free_slots - cache->p_old_slots) / cache->p_num_slots;
+    /* Update counter, or native integer which has the same data,
+     * in place. Data is only 4 byte aligned */
+    } else if ((S_Flags(base_det) & (MMC_COUNTER | MMC_IVVAL)) && S_ValLen(base_det) == sizeof(MI64)) {
+      memcpy(&value, S_ValPtr(base_det), sizeof(MI64));
+      value += delta;
+      memcpy(S_ValPtr(base_det), &value, sizeof(MI64));
 
-    /* Nothing to do if hash table more than 30% free slots and enough free space */
-    if (slots_pct > 0.3 && cache->p_free_bytes >= kvlen)
+      S_LastAccess(base_det) = now;
+      _mmc_set_flags(cache, base_det, (S_Flags(base_det) & ~MMC_IVVAL) | MMC_COUNTER | (flags & ~MMC_LAYOUT_FLAGS));
+      CAS_Next(cache, base_det);
+      cache->p_changed = 1;
+
+      *result = value;
       return 0;
-  }
 
-  {
-    MU32 num_slots = cache->p_num_slots;
+    /* Otherwise parse decimal string value and convert */
+    } else {
+      char * ptr = (char *)S_ValPtr(base_det);
+      int len = (int)S_ValLen(base_det), i = 0, neg = 0;
+      MU64 mag = 0, limit;
+
+      if (len > 0 && ptr[0] == '-') { neg = 1; i++; }
+      if (i == len || len > 20)
+        return -1;
+
+      /* Accumulate unsigned, and stop before going past the range
+       * of a signed 64 bit value, which is one more if negative */
+      limit = ((MU64)1 << 63) - (neg ? 0 : 1);
+      for (; i < len; i++) {
+        unsigned digit = (unsigned)(ptr[i] - '0');
+        if (ptr[i] < '0' || ptr[i] > '9' || mag > (limit - digit) / 10)
+          return -1;
+        mag = mag * 10 + digit;
+      }
+      value = neg ? (MI64)(0 - mag) : (MI64)mag;
+
+      expire_seconds = expire_time ? (expire_time > now ? expire_time - now : 1) : 0;
+    }
+  }
+
+  value += delta;
+  if (!mmc_write_ext(cache, hash_slot, key_ptr, key_len, &value, sizeof(MI64), expire_seconds, 0, 0, flags | MMC_COUNTER))
+    return -2;
+
+  *result = value;
+  return 0;
+}
+
+/*
+ * int mmc_touch(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 expire_seconds
+ * )
+ *
+ * Set the expiry time of key in current page to expire_seconds
+ * from now, without changing the value. As for mmc_write(), an
+ * expire_seconds of 0 means never expire, and -1 means use the
+ * cache default. Also counts as an access for the LRU expunge
+ *
+ * Returns 1 if done, 0 if key wasn't found or has already expired
+ *
+*/
+int mmc_touch(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 expire_seconds
+) {
+  MU32 * base_det, now;
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (!slot_ptr || *slot_ptr <= 1)
+    return 0;
+
+  base_det = S_Ptr(cache->p_base, *slot_ptr);
+  now = (MU32)time(0);
+
+  /* Already expired, delete it like a read would */
+  if (S_IsExpired(cache, base_det, now)) {
+    _mmc_delete_slot(cache, slot_ptr);
+    return 0;
+  }
+  if (S_Flags(base_det) & MMC_LEASE)
+    return 0;
+
+  if (expire_seconds == (MU32)-1) expire_seconds = cache->expire_time;
+  S_ExpireTime(base_det) = expire_seconds ? now + expire_seconds : 0;
+  S_LastAccess(base_det) = now;
+
+  return 1;
+}
+
+/*
+ * int mmc_lease(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 lease_seconds
+ * )
+ *
+ * Take a lease on key in the current page, to show that this
+ * process is calculating the value for it, by storing a
+ * placeholder item that expires after lease_seconds. Readers see
+ * the placeholder as not found. Writing a value for the key
+ * replaces it, or use mmc_lease_release() to give up the lease
+ *
+ * Returns 1 if the lease was taken, 0 if another process holds
+ * an unexpired lease or there's now a value for key, -1 if the
+ * placeholder couldn't be stored
+ *
+*/
+int mmc_lease(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 lease_seconds
+) {
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (slot_ptr && *slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+
+    if (!S_IsExpired(cache, base_det, (MU32)time(0)))
+      return 0;
+  }
+
+  if (!mmc_write_ext(cache, hash_slot, key_ptr, key_len, "", 0, lease_seconds ? lease_seconds : 1, 0, 0, MMC_LEASE))
+    return -1;
+
+  return 1;
+}
+
+/*
+ * int mmc_lease_release(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len
+ * )
+ *
+ * Delete the lease placeholder for key in the current page,
+ * leaving any value written since alone
+ *
+ * Returns 1 if a lease was deleted, 0 if not
+ *
+*/
+int mmc_lease_release(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len
+) {
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (!slot_ptr || *slot_ptr <= 1)
+    return 0;
+  if (!(S_Flags(S_Ptr(cache->p_base, *slot_ptr)) & MMC_LEASE))
+    return 0;
+
+  _mmc_delete_slot(cache, slot_ptr);
+  return 1;
+}
+
+/*
+ * int mmc_refresh(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 lease_seconds
+ * )
+ *
+ * If key in the current page is stale, and no one else is
+ * refreshing it, give the caller the job of refreshing it. Other
+ * callers won't be given the job till lease_seconds have passed,
+ * in case the caller fails. Readers still see the value as stale
+ * till a new value is written
+ *
+ * Returns 1 if the caller should refresh the value, 0 otherwise
+ *
+*/
+int mmc_refresh(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 lease_seconds
+) {
+  MU32 * base_det, now;
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (!slot_ptr || *slot_ptr <= 1)
+    return 0;
+
+  base_det = S_Ptr(cache->p_base, *slot_ptr);
+  now = (MU32)time(0);
+
+  if (S_IsExpired(cache, base_det, now))
+    return 0;
+  if (S_Flags(base_det) & MMC_LEASE)
+    return 0;
+  if (!(S_Flags(base_det) & MMC_SOFT) || now <= S_SoftExpire(base_det))
+    return 0;
+
+  S_SoftExpire(base_det) = now + (lease_seconds ? lease_seconds : 1);
+  S_Flags(base_det) |= MMC_REFRESHING;
+
+  return 1;
+}
+
+int last_access_cmp(const void * a, const void * b) {
+  MU32 * ad = *(MU32 **)a, * bd = *(MU32 **)b;
+  MU32 av = S_LastAccess(ad);
+  MU32 bv = S_LastAccess(bd);
+  int cas_diff;
+  if (av < bv) return -1;
+  if (av > bv) return 1;
+
+  /* Access times are only to the second, so fall back to the CAS
+   *  value to order items written in the same second, allowing
+   *  for it wrapping */
+  cas_diff = (int)(S_Cas(ad) - S_Cas(bd));
+  if (cas_diff < 0) return -1;
+  if (cas_diff > 0) return 1;
+  return 0;
+}
+
+/*
+ * int mmc_calc_expunge(
+ *   cache_mmap * cache, int mode, int len, MU32 * new_num_slots, MU32 *** to_expunge
+ * )
+ *
+ * Calculate entries to expunge from current page.
+ *
+ *  If len >= 0
+ *    If space available for len bytes & >30% slots free, nothing is expunged
+ *  If len < 0 or not above
+ *    If mode == 0, only expired items are expunged
+ *    If mode == 1, all entries are expunged
+ *    If mode == 2, entries are expunged till 40% free space is created
+ *    
+ * If expunged is non-null pointer, result is filled with
+ * a list of slots to expunge
+ *
+ * Return value is number of items to expunge
+ *
+*/
+int mmc_calc_expunge(
+  mmap_cache * cache,
+  int mode, int len,
+  MU32 * new_num_slots, MU32 *** to_expunge
+) {
+  return mmc_calc_expunge_many(cache, mode, 1, len, new_num_slots, to_expunge);
+}
+
+/*
+ * int mmc_calc_expunge_many(
+ *   cache_mmap * cache, int mode, int n_items, int len,
+ *   MU32 * new_num_slots, MU32 *** to_expunge
+ * )
+ *
+ * As mmc_calc_expunge(), but make room for n_items entries with
+ * a total of len bytes of key/value data, so a batch of writes
+ * to one page only needs a single expunge run. In mode 2, enough
+ * entries are expunged to fit the whole batch if it's larger
+ * than the usual 40% free space.
+ *
+*/
+int mmc_calc_expunge_many(
+  mmap_cache * cache,
+  int mode, int n_items, int len,
+  MU32 * new_num_slots, MU32 *** to_expunge
+) {
+  double slots_pct;
+  MU32 kvlen = 0;
+
+  ASSERT(cache->p_cur != -1);
+  ASSERT(n_items >= 1);
+
+  /* If len >= 0, and space available for len bytes, nothing is expunged */
+  if (len >= 0) {
+    /* Length of key/value data when stored, each extra item
+       needs its own header and may be rounded up. Allow for
+       the largest header an item can have */
+    kvlen = KV_SlotLen(MMC_LAYOUT_FLAGS, len, 0);
+    ROUNDLEN(kvlen);
+    kvlen += (n_items - 1) * (KV_SlotLen(MMC_LAYOUT_FLAGS, 0, 0) + 3);
+
+    slots_pct = ((double)(cache->p_free_slots - cache->p_old_slots) - (n_items - 1)) / cache->p_num_slots;
+
+    /* Nothing to do if hash table more than 30% free slots and enough free space */
+    if (slots_pct > 0.3 && cache->p_free_bytes >= kvlen)
+      return 0;
+  }
+
+  {
+    MU32 num_slots = cache->p_num_slots;
 
     MU32 used_slots = num_slots - cache->p_free_slots;
     MU32 * slot_ptr = cache->p_base_slots;
@@ -626,7 +1408,7 @@ int mmc_calc_expunge(
     MU32 ** copy_base_det_out = copy_base_det;
     MU32 ** copy_base_det_in = copy_base_det + used_slots;
 
-    MU32 page_data_size = cache->c_page_size - num_slots * 4 - P_HEADERSIZE;
+    MU32 page_data_size = cache->c_page_size - num_slots * 4 - P_HeaderSize(cache);
     MU32 in_slots, data_thresh, used_data = 0;
     MU32 now = (MU32)time(0);
 
@@ -650,7 +1432,7 @@ int mmc_calc_expunge(
       /* Definitely out if expired, and not dirty */
       expire_time = S_ExpireTime(base_det);
       flags = S_Flags(base_det);
-      if (expire_time && now >= expire_time) {
+      if ((expire_time && now >= expire_time) || S_NsBumped(cache, base_det)) {
         *copy_base_det_out++ = base_det;
         continue;
       }
@@ -671,11 +1453,19 @@ int mmc_calc_expunge(
     ASSERT(mode != 1 || copy_base_det_out == copy_base_det_end);
 
     /* Increase slot count if free count is low and there's space to increase */
-    slots_pct = (double)(copy_base_det_end - copy_base_det_out) / num_slots;
+    slots_pct = (double)(copy_base_det_end - copy_base_det_out + n_items - 1) / num_slots;
     if (slots_pct > 0.3 && (page_data_size - used_data > (num_slots + 1) * 4 || mode == 2)) {
       num_slots = (num_slots * 2) + 1;
+
+      /* A batch of items may need more again, as long as the
+         slots and data still fit in the page */
+      while (n_items > 1 &&
+          (double)(copy_base_det_end - copy_base_det_out + n_items - 1) / num_slots > 0.3 &&
+          P_HeaderSize(cache) + (num_slots * 2 + 1) * 4 + used_data < cache->c_page_size) {
+        num_slots = (num_slots * 2) + 1;
+      }
     }
-    page_data_size = cache->c_page_size - num_slots * 4 - P_HEADERSIZE;
+    page_data_size = cache->c_page_size - num_slots * 4 - P_HeaderSize(cache);
 
     /* If mode == 0 or 1, we've just worked out ones to keep and
      *  which to dispose of, so return results */
@@ -694,6 +1484,10 @@ int mmc_calc_expunge(
     /* Throw out old slots till we have 40% free data space */
     data_thresh = (MU32)(0.6 * page_data_size);
 
+    /* Unless a batch of items needs even more than that */
+    if (n_items > 1 && kvlen < page_data_size && page_data_size - kvlen < data_thresh)
+      data_thresh = page_data_size - kvlen;
+
     while (copy_base_det_in != copy_base_det_end && used_data >= data_thresh) {
       MU32 * slot_ptr = *copy_base_det_in;
       MU32 kvlen = S_SlotLen(slot_ptr);
@@ -735,104 +1529,992 @@ int mmc_do_expunge(
   MU32 slot_data_size = new_num_slots * 4;
   MU32 * new_slot_data = (MU32 *)malloc(slot_data_size);
 
-  MU32 page_data_size = cache->c_page_size - new_num_slots * 4 - P_HEADERSIZE;
+  MU32 page_data_size = cache->c_page_size - new_num_slots * 4 - P_HeaderSize(cache);
 
   void * new_kv_data = malloc(page_data_size);
   MU32 new_offset = 0;
 
+  MU32 bloom_bits = cache->c_bloom_words * 32, * bloom = P_Bloom(cache->p_base);
+  MU32 * new_bloom = (MU32 *)calloc(cache->c_bloom_words, 4);
+  MU32 i, n_dirty = 0;
+
   /* Start all new slots empty */
   memset(new_slot_data, 0, slot_data_size);
 
-  /* Copy entries to keep to new slot entires and data sections */
-  for (;to_keep < to_keep_end; to_keep++) {
-    MU32 * old_base_det = *to_keep;
-    MU32 * new_slot_ptr;
-    MU32 kvlen;
+  /* Copy entries to keep to new slot entires and data sections */
+  for (;to_keep < to_keep_end; to_keep++) {
+    MU32 * old_base_det = *to_keep;
+    MU32 * new_slot_ptr;
+    MU32 kvlen;
+
+    /* Hash key to find starting slot */
+    MU32 slot = S_SlotHash(old_base_det) % new_num_slots;
+
+    BLOOM_SET(new_bloom, BLOOM_H1(S_SlotHash(old_base_det), bloom_bits));
+    BLOOM_SET(new_bloom, BLOOM_H2(S_SlotHash(old_base_det), bloom_bits));
+    if (S_Flags(old_base_det) & MMC_DIRTY) n_dirty++;
+
+#ifdef DEBUG
+    /* Check hash actually matches stored value */
+    {
+      MU32 hash_page_dummy, hash_slot;
+      mmc_hash(cache, S_KeyPtr(old_base_det), S_KeyLen(old_base_det), &hash_page_dummy, &hash_slot);
+
+      ASSERT(hash_slot == S_SlotHash(old_base_det));
+    }
+#endif
+
+    /* Find free slot */
+    new_slot_ptr = new_slot_data + slot;
+    while (*new_slot_ptr) {
+      if (++slot >= new_num_slots) { slot = 0; }
+      new_slot_ptr = new_slot_data + slot;
+    }
+
+    /* Copy slot and KV data */
+    kvlen = S_SlotLen(old_base_det);
+    memcpy(PTR_ADD(new_kv_data, new_offset), old_base_det, kvlen);
+
+    /* Store slot data and mark as used */
+    *new_slot_ptr = new_offset + new_num_slots * 4 + P_HeaderSize(cache);
+
+    ROUNDLEN(kvlen);
+    new_offset += kvlen;
+  }
+
+  ASSERT(new_offset <= page_data_size);
+
+/*  printf("page=%d\n", cache->p_cur);
+  printf("old_slots=%d, new_slots=%d\n", old_num_slots, new_num_slots);
+  printf("old_used_slots=%d, new_used_slots=%d\n", old_used_slots, new_used_slots);*/
+
+  /* Store back into mmap'ed file space */
+  memcpy(base_slots, new_slot_data, slot_data_size);
+  memcpy(base_slots + new_num_slots, new_kv_data, new_offset);
+
+  /* Rebuilt filter only has bits cleared for expunged items, so
+   * readers checking it without the lock never miss a kept item */
+  for (i = 0; i < cache->c_bloom_words; i++)
+    bloom[i] = new_bloom[i];
+
+  cache->p_num_slots = new_num_slots;
+  cache->p_free_slots = new_num_slots - new_used_slots;
+  cache->p_old_slots = 0;
+  cache->p_free_data = new_offset + new_num_slots * 4 + P_HeaderSize(cache);
+  cache->p_free_bytes = page_data_size - new_offset;
+  cache->p_n_dirty = n_dirty;
+
+  /* Make sure changes are saved back to mmap'ed file */
+  cache->p_changed = 1;
+
+  /* Free allocated memory */
+  free(new_kv_data);
+  free(new_slot_data);
+  free(new_bloom);
+  free(to_expunge);
+
+  ASSERT(_mmc_test_page(cache));
+
+  return 0;
+}
+
+/*
+ * void mmc_get_page_details(mmap_cache * cache, MU32 * n_reads, MU32 * n_read_hits)
+ *
+ * Return details about the current locked page. Currently just
+ * number of reads and number of reads that hit
+ *
+*/
+void mmc_get_page_details(mmap_cache * cache, MU32 * n_reads, MU32 * n_read_hits) {
+  *n_reads = cache->p_n_reads;
+  *n_read_hits = cache->p_n_read_hits;
+  return;
+}
+
+/*
+ * void mmc_reset_page_details(mmap_cache * cache)
+ *
+ * Reset any page details (currently just read hits)
+ *
+*/
+void mmc_reset_page_details(mmap_cache * cache) {
+  cache->p_n_reads = 0;
+  cache->p_n_read_hits = 0;
+  cache->p_changed = 1;
+  return;
+}
+
+/*
+ * int mmc_queue_lock(mmap_cache * cache)
+ *
+ * Lock the write behind queue. Returns 0 on success, -1 if the
+ * cache has no queue or the lock failed. The queue can be locked
+ * while a page is locked (expunges push dirty items onto it), but
+ * no page may be locked while the queue is locked
+ *
+*/
+int mmc_queue_lock(mmap_cache * cache) {
+  if (!cache->c_queue_size)
+    return -1;
+  return mmc_lock_range(cache, cache->c_queue_offset, cache->c_queue_size);
+}
+
+/*
+ * int mmc_queue_unlock(mmap_cache * cache)
+ *
+ * Unlock the write behind queue
+ *
+*/
+int mmc_queue_unlock(mmap_cache * cache) {
+  return mmc_unlock_range(cache, cache->c_queue_offset, cache->c_queue_size);
+}
+
+/*
+ * int mmc_queue_push(
+ *   mmap_cache * cache,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len,
+ *   MU32 expire_time, MU32 flags
+ * )
+ *
+ * Add an item to the end of the locked write behind queue. Called
+ * with the item's page locked, so the tags of a tagged item can be
+ * copied from the page's tag index for mmc_queue_remove()
+ *
+ * Returns 1 if added, 0 if there isn't space for it
+ *
+*/
+int mmc_queue_push(
+  mmap_cache * cache,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_time, MU32 flags
+) {
+  void * q_ptr = Q_Base(cache);
+  MU32 size = Q_Size(q_ptr), head = Q_Head(q_ptr), tail = Q_Tail(q_ptr);
+  MU32 hash_page, hash_slot, n_tags = 0, i, len, * e;
+  volatile MU32 * t = 0;
+
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  if ((flags & MMC_TAGGED) && cache->c_tag_slots && cache->p_cur != (MU32)-1) {
+    t = T_Seg(cache, cache->p_cur);
+    for (i = 0; i < T_Count(t); i++) {
+      if (T_Slot(t, i) == hash_slot)
+        n_tags++;
+    }
+  }
+
+  len = QE_HEADERSIZE + n_tags * 4 + key_len + val_len;
+  ROUNDLEN(len);
+
+  /* Empty, start from the beginning again */
+  if (!Q_Count(q_ptr))
+    head = tail = 0;
+
+  /* Full */
+  else if (head == tail)
+    return 0;
+
+  if (tail >= head) {
+    /* Not enough space at the end, mark it unused and wrap */
+    if (len > size - tail) {
+      if (len > head)
+        return 0;
+      QE_Len((MU32 *)PTR_ADD(Q_Data(q_ptr), tail)) = 0;
+      tail = 0;
+    }
+  } else if (len > head - tail) {
+    return 0;
+  }
+
+  e = (MU32 *)PTR_ADD(Q_Data(q_ptr), tail);
+  QE_Len(e) = len;
+  QE_ExpireTime(e) = expire_time;
+  QE_Flags(e) = flags;
+  QE_KeyLen(e) = (MU32)key_len;
+  QE_ValLen(e) = (MU32)val_len;
+  QE_NTags(e) = n_tags;
+  if (n_tags) {
+    MU32 * tag_ptr = QE_TagPtr(e);
+    for (i = 0; i < T_Count(t); i++) {
+      if (T_Slot(t, i) == hash_slot)
+        *tag_ptr++ = T_Tag(t, i);
+    }
+  }
+  memcpy(QE_KeyPtr(e), key_ptr, key_len);
+  memcpy(QE_ValPtr(e), val_ptr, val_len);
+
+  tail += len;
+  if (tail == size) tail = 0;
+
+  Q_Head(q_ptr) = head;
+  Q_Tail(q_ptr) = tail;
+  Q_Count(q_ptr)++;
+  _mmc_queue_bloom(cache, hash_slot, 1);
+
+  return 1;
+}
+
+/*
+ * int mmc_queue_pop(
+ *   mmap_cache * cache,
+ *   void **key_ptr, int *key_len,
+ *   void **val_ptr, int *val_len,
+ *   MU32 *expire_time, MU32 *flags
+ * )
+ *
+ * Remove the oldest item from the locked write behind queue,
+ * skipping over any removed by mmc_queue_remove(). Returns 1 and
+ * sets the pointers to the item data if there was one, 0 if the
+ * queue is empty. The data pointers are only valid till the next
+ * push or the queue is unlocked
+ *
+*/
+int mmc_queue_pop(
+  mmap_cache * cache,
+  void **key_ptr, int *key_len,
+  void **val_ptr, int *val_len,
+  MU32 *expire_time, MU32 *flags
+) {
+  void * q_ptr = Q_Base(cache);
+  MU32 head = Q_Head(q_ptr);
+  MU32 * e;
+
+  while (Q_Count(q_ptr)) {
+
+    /* Rest of queue data unused, item is at the start */
+    e = (MU32 *)PTR_ADD(Q_Data(q_ptr), head);
+    if (!QE_Len(e)) {
+      head = 0;
+      e = (MU32 *)Q_Data(q_ptr);
+    }
+
+    head += QE_Len(e);
+    if (head == Q_Size(q_ptr)) head = 0;
+
+    Q_Head(q_ptr) = head;
+    Q_Count(q_ptr)--;
+
+    /* Start the bloom filter again when there's nothing in it */
+    if (!Q_Count(q_ptr))
+      memset(Q_Bloom(q_ptr), 0, Q_BloomLen(cache));
+    else if (!QE_IsRemoved(e))
+      _mmc_queue_bloom_key(cache, QE_KeyPtr(e), (int)QE_KeyLen(e), -1);
+
+    if (QE_IsRemoved(e))
+      continue;
+
+    *key_ptr = QE_KeyPtr(e);
+    *key_len = (int)QE_KeyLen(e);
+    *val_ptr = QE_ValPtr(e);
+    *val_len = (int)QE_ValLen(e);
+    *expire_time = QE_ExpireTime(e);
+    *flags = QE_Flags(e);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * int mmc_queue_find(
+ *   mmap_cache * cache,
+ *   void *key_ptr, int key_len,
+ *   void **val_ptr, int *val_len,
+ *   MU32 *expire_time, MU32 *flags
+ * )
+ *
+ * Find the newest item for key in the locked write behind queue,
+ * which is a newer value than the underlying store has. Returns
+ * 1 and sets the pointers to the item data if there was one, 0
+ * if not or the newest item has expired. The data pointers are
+ * only valid till the queue is unlocked
+ *
+*/
+int mmc_queue_find(
+  mmap_cache * cache,
+  void *key_ptr, int key_len,
+  void **val_ptr, int *val_len,
+  MU32 *expire_time, MU32 *flags
+) {
+  void * q_ptr = Q_Base(cache);
+  MU32 pos = Q_Head(q_ptr), n_items = Q_Count(q_ptr);
+  MU32 now = (MU32)time(0);
+  int found = 0;
+
+  /* Most keys aren't in the queue, so don't search it for them */
+  if (!mmc_queue_maybe(cache, key_ptr, key_len))
+    return 0;
+
+  for (; n_items; n_items--) {
+    MU32 * e = (MU32 *)PTR_ADD(Q_Data(q_ptr), pos);
+
+    /* Rest of queue data unused, next item is at the start */
+    if (!QE_Len(e)) {
+      pos = 0;
+      e = (MU32 *)Q_Data(q_ptr);
+    }
+
+    if (!QE_IsRemoved(e) && QE_KeyLen(e) == (MU32)key_len && !memcmp(QE_KeyPtr(e), key_ptr, key_len)) {
+      *val_ptr = QE_ValPtr(e);
+      *val_len = (int)QE_ValLen(e);
+      *expire_time = QE_ExpireTime(e);
+      *flags = QE_Flags(e);
+      found = 1;
+    }
+
+    pos += QE_Len(e);
+    if (pos == Q_Size(q_ptr)) pos = 0;
+  }
+
+  /* Expired items are only queued to be written back. Items whose
+     namespace was bumped are queued with an expiry time of 1 */
+  if (found && *expire_time && now > *expire_time)
+    return 0;
+
+  return found;
+}
+
+/*
+ * int mmc_queue_remove(
+ *   mmap_cache * cache, int mode,
+ *   void *match_ptr, int match_len, MU32 match,
+ *   MU32 first_page, MU32 end_page
+ * )
+ *
+ * Remove items from the write behind queue, so they're neither
+ * found nor written back. Only items whose keys hash to pages
+ * first_page to end_page - 1 are removed, and of those:
+ *
+ * MMC_QUEUE_ALL - every item
+ * MMC_QUEUE_KEY - items with the key match_ptr/match_len
+ * MMC_QUEUE_GLOB - items with keys matching the shell style
+ *   pattern match_ptr/match_len (see mmc_match_page())
+ * MMC_QUEUE_NS - items in the namespace of the entry flags match
+ * MMC_QUEUE_TAG - items tagged with the tag hash match
+ *
+ * Removed items are just marked, and their space is reclaimed as
+ * they reach the head of the queue. Locks the queue itself, so
+ * must be called without it locked, but may be called with a
+ * page locked
+ *
+ * Returns the number of items removed, 0 if there's no queue, or
+ * -1 if it couldn't be locked
+ *
+*/
+int mmc_queue_remove(
+  mmap_cache * cache, int mode,
+  void *match_ptr, int match_len, MU32 match,
+  MU32 first_page, MU32 end_page
+) {
+  void * q_ptr;
+  MU32 pos, n_items;
+  int n_removed = 0;
+
+  /* Items can only be pushed with their page locked, so with it
+     locked, nothing to remove can be added after this check */
+  if (!mmc_queue_count(cache))
+    return 0;
+  if (mmc_queue_lock(cache))
+    return -1;
+
+  q_ptr = Q_Base(cache);
+  pos = Q_Head(q_ptr);
+  for (n_items = Q_Count(q_ptr); n_items; n_items--) {
+    MU32 * e = (MU32 *)PTR_ADD(Q_Data(q_ptr), pos);
+    MU32 hash_page, hash_slot, i;
+    int remove = 0;
+
+    /* Rest of queue data unused, next item is at the start */
+    if (!QE_Len(e)) {
+      pos = 0;
+      e = (MU32 *)Q_Data(q_ptr);
+    }
+    pos += QE_Len(e);
+    if (pos == Q_Size(q_ptr)) pos = 0;
+
+    if (QE_IsRemoved(e))
+      continue;
+    mmc_hash(cache, QE_KeyPtr(e), (int)QE_KeyLen(e), &hash_page, &hash_slot);
+    if (hash_page < first_page || hash_page >= end_page)
+      continue;
+
+    switch (mode) {
+      case MMC_QUEUE_ALL:
+        remove = 1;
+        break;
+      case MMC_QUEUE_KEY:
+        remove = QE_KeyLen(e) == (MU32)match_len && !memcmp(QE_KeyPtr(e), match_ptr, match_len);
+        break;
+      case MMC_QUEUE_GLOB:
+        remove = _mmc_glob_match((const char *)match_ptr, match_len, (const char *)QE_KeyPtr(e), (int)QE_KeyLen(e));
+        break;
+      case MMC_QUEUE_NS:
+        remove = (QE_Flags(e) & MMC_NS_MASK) == (match & MMC_NS_MASK);
+        break;
+      case MMC_QUEUE_TAG:
+        for (i = 0; i < QE_NTags(e); i++) {
+          if (QE_TagPtr(e)[i] == match)
+            remove = 1;
+        }
+        break;
+    }
+
+    if (remove) {
+      QE_Flags(e) &= ~MMC_DIRTY;
+      _mmc_queue_bloom(cache, hash_slot, -1);
+      n_removed++;
+    }
+  }
+
+  mmc_queue_unlock(cache);
+  return n_removed;
+}
+
+/*
+ * int mmc_queue_maybe(mmap_cache * cache, void *key_ptr, int key_len)
+ *
+ * Returns false if there's definitely no item for key in the write
+ * behind queue, from the queue's bloom filter, true if there may
+ * be. Doesn't need the queue to be locked, so an item may have been
+ * added or removed by the time it's locked
+ *
+*/
+int mmc_queue_maybe(mmap_cache * cache, void *key_ptr, int key_len) {
+  MU32 hash_page, hash_slot, n = Q_BloomLen(cache);
+  unsigned char * bloom;
+
+  if (!mmc_queue_count(cache))
+    return 0;
+
+  bloom = Q_Bloom(Q_Base(cache));
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  return bloom[BLOOM_H1(hash_slot, n)] && bloom[BLOOM_H2(hash_slot, n)];
+}
+
+/*
+ * void _mmc_queue_bloom(mmap_cache * cache, MU32 hash_slot, int delta)
+ *
+ * Add delta to the counters for a key's hash slot in the locked
+ * write behind queue's bloom filter. Counters that reach 255 are
+ * left there, as they may have counted more items than that
+ *
+*/
+void _mmc_queue_bloom(mmap_cache * cache, MU32 hash_slot, int delta) {
+  MU32 n = Q_BloomLen(cache);
+  unsigned char * bloom = Q_Bloom(Q_Base(cache));
+  unsigned char * c1 = bloom + BLOOM_H1(hash_slot, n);
+  unsigned char * c2 = bloom + BLOOM_H2(hash_slot, n);
+
+  if (*c1 != 255 && (delta > 0 || *c1)) *c1 += delta;
+  if (c2 != c1 && *c2 != 255 && (delta > 0 || *c2)) *c2 += delta;
+}
+
+/*
+ * void _mmc_queue_bloom_key(mmap_cache * cache, void *key_ptr, int key_len, int delta)
+ *
+ * As _mmc_queue_bloom(), for the hash slot of a key
+ *
+*/
+void _mmc_queue_bloom_key(mmap_cache * cache, void *key_ptr, int key_len, int delta) {
+  MU32 hash_page, hash_slot;
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  _mmc_queue_bloom(cache, hash_slot, delta);
+}
+
+/*
+ * int mmc_queue_count(mmap_cache * cache)
+ *
+ * Number of items in the write behind queue, 0 if the cache
+ * has no queue. Doesn't need the queue to be locked
+ *
+*/
+int mmc_queue_count(mmap_cache * cache) {
+  if (!cache->c_queue_size)
+    return 0;
+  return (int)Q_Count(Q_Base(cache));
+}
+
+/*
+ * int mmc_dirty_pages(mmap_cache * cache, MU32 * pages)
+ *
+ * Fill in pages (which must have space for all the pages in the
+ * cache) with the numbers of pages that have dirty items, from the
+ * dirty item counts. Doesn't need any page locked, so a page may
+ * have changed by the time it's locked
+ *
+ * Returns the number of pages
+ *
+*/
+int mmc_dirty_pages(mmap_cache * cache, MU32 * pages) {
+  MU32 i;
+  int n_pages = 0;
+
+  for (i = 0; i < cache->c_num_pages; i++) {
+    if (D_Count(cache, i))
+      pages[n_pages++] = i;
+  }
+
+  return n_pages;
+}
+
+/*
+ * int mmc_clean_page(mmap_cache * cache, MU32 *** dirty)
+ *
+ * Clear the dirty flag of all items in the current page, so they
+ * can be written back to the underlying store while staying in
+ * the cache. Sets *dirty to a list of pointers to the items,
+ * which the caller must free(). Use mmc_get_details() to get each
+ * item's details, before unlocking the page
+ *
+ * Returns the number of items
+ *
+*/
+int mmc_clean_page(mmap_cache * cache, MU32 *** dirty) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  MU32 ** items;
+  int n_items = 0;
+
+  *dirty = items = (MU32 **)malloc(sizeof(MU32 *) * (cache->p_n_dirty + 1));
+
+  for (; slot_ptr != slot_end && cache->p_n_dirty; slot_ptr++) {
+    MU32 * base_det;
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    if (S_Flags(base_det) & MMC_DIRTY) {
+      _mmc_set_flags(cache, base_det, S_Flags(base_det) & ~MMC_DIRTY);
+      items[n_items++] = base_det;
+    }
+  }
+
+  return n_items;
+}
+
+/*
+ * MU32 mmc_ns_flags(mmap_cache * cache, void * name_ptr, int name_len)
+ *
+ * Return the entry flag bits for the namespace with the given name,
+ * or 0 if the cache has no namespaces. Names are hashed to one of
+ * the c_num_ns generation counters, so different names may share one
+ *
+*/
+MU32 mmc_ns_flags(mmap_cache * cache, void * name_ptr, int name_len) {
+  MU32 h = 0x92f7e3b1;
+  unsigned char * uc_name_ptr = (unsigned char *)name_ptr;
+  unsigned char * uc_name_ptr_end = uc_name_ptr + name_len;
+
+  if (!cache->c_num_ns)
+    return 0;
+
+  while (uc_name_ptr != uc_name_ptr_end) {
+    h = (h << 4) + (h >> 28) + *uc_name_ptr++;
+  }
+
+  return (h % cache->c_num_ns + 1) << MMC_NS_SHIFT;
+}
+
+/*
+ * MU32 mmc_ns_bump(mmap_cache * cache, MU32 ns_flags)
+ *
+ * Increment the generation of the namespace in ns_flags (as returned
+ * by mmc_ns_flags()), so every item written to it before now reads
+ * as expired, and is removed the next time its page is expunged.
+ * Doesn't lock any pages, just the counter itself and the write
+ * behind queue, except once every 2^32 bumps when the generation
+ * wraps round
+ *
+ * Returns the new generation, or 0 if there's no such namespace
+ * or the counter or pages couldn't be locked
+ *
+*/
+MU32 mmc_ns_bump(mmap_cache * cache, MU32 ns_flags) {
+  MU32 ns_id = (ns_flags & MMC_NS_MASK) >> MMC_NS_SHIFT;
+  MU32 offset, gen;
+
+  if (!ns_id || ns_id > cache->c_num_ns)
+    return 0;
+
+  offset = cache->c_ns_offset + (ns_id - 1) * 4;
+  if (mmc_lock_range(cache, offset, 4))
+    return 0;
+
+  /* Before the generation wraps round, expire every item in the
+     namespace so items from a full cycle ago can't match again */
+  if (NS_Gen(cache, ns_id) == (MU32)-1 && _mmc_ns_expire(cache, ns_id)) {
+    mmc_unlock_range(cache, offset, 4);
+    return 0;
+  }
+
+  /* Items in a new namespace are written with generation 0, so
+     never use it again */
+  gen = ++NS_Gen(cache, ns_id);
+  if (!gen)
+    gen = ++NS_Gen(cache, ns_id);
+  mmc_unlock_range(cache, offset, 4);
+
+  /* Items waiting in the write behind queue were written before
+     the bump. Items pushed out of pages later are queued with an
+     expiry time of 1 (see mmc_get_details()) */
+  mmc_queue_remove(cache, MMC_QUEUE_NS, 0, 0, ns_flags, 0, cache->c_num_pages);
+
+  return gen;
+}
+
+/*
+ * int _mmc_ns_expire(mmap_cache * cache, MU32 ns_id)
+ *
+ * Lock each page in turn and set every item in namespace ns_id
+ * to expired, whatever generation it was written in
+ *
+ * Returns 0 on success, -1 if a page couldn't be locked
+ *
+*/
+int _mmc_ns_expire(mmap_cache * cache, MU32 ns_id) {
+  MU32 p_cur;
+
+  for (p_cur = 0; p_cur < cache->c_num_pages; p_cur++) {
+    MU32 * slot_ptr, * slot_end;
+
+    if (mmc_lock(cache, p_cur))
+      return -1;
+
+    slot_ptr = cache->p_base_slots;
+    slot_end = slot_ptr + cache->p_num_slots;
+    for (; slot_ptr != slot_end; slot_ptr++) {
+      MU32 * base_det;
+      if (*slot_ptr <= 1)
+        continue;
+
+      base_det = S_Ptr(cache->p_base, *slot_ptr);
+      if (S_NsId(base_det) == ns_id)
+        S_ExpireTime(base_det) = 1;
+    }
+
+    mmc_unlock(cache);
+  }
+
+  return 0;
+}
+
+/*
+ * MU32 mmc_tag_hash(void * tag_ptr, int tag_len)
+ *
+ * Hash the given tag name for the tag index
+ *
+*/
+MU32 mmc_tag_hash(void * tag_ptr, int tag_len) {
+  MU32 h = 0x92f7e3b1;
+  unsigned char * uc_tag_ptr = (unsigned char *)tag_ptr;
+  unsigned char * uc_tag_ptr_end = uc_tag_ptr + tag_len;
+
+  while (uc_tag_ptr != uc_tag_ptr_end) {
+    h = (h << 4) + (h >> 28) + *uc_tag_ptr++;
+  }
+
+  return h;
+}
+
+int _mmc_cmp_mu32(const void * a, const void * b) {
+  MU32 x = *(const MU32 *)a, y = *(const MU32 *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * int _mmc_tagged_slots(mmap_cache * cache, MU32 ** slots)
+ *
+ * Set *slots to a sorted list of the hash slots of the tagged
+ * items in the current page, which the caller must free()
+ *
+ * Returns the number of hash slots
+ *
+*/
+int _mmc_tagged_slots(mmap_cache * cache, MU32 ** slots) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  int n_slots = 0;
+
+  *slots = (MU32 *)malloc(sizeof(MU32) * (cache->p_num_slots - cache->p_free_slots + 1));
+
+  for (; slot_ptr != slot_end; slot_ptr++) {
+    MU32 * base_det;
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    if (S_Flags(base_det) & MMC_TAGGED)
+      (*slots)[n_slots++] = S_SlotHash(base_det);
+  }
+
+  qsort(*slots, n_slots, sizeof(MU32), _mmc_cmp_mu32);
+  return n_slots;
+}
 
-    /* Hash key to find starting slot */
-    MU32 slot = S_SlotHash(old_base_det) % new_num_slots;
+/*
+ * void _mmc_tag_sweep(mmap_cache * cache)
+ *
+ * Remove references from the current page's tag index to items
+ * that have since been deleted, expunged, or replaced by untagged
+ * items
+ *
+*/
+void _mmc_tag_sweep(mmap_cache * cache) {
+  volatile MU32 * t = T_Seg(cache, cache->p_cur);
+  MU32 * slots, i, n_used = 0;
+  int n_slots = _mmc_tagged_slots(cache, &slots);
+
+  for (i = 0; i < T_Count(t); i++) {
+    MU32 hash_slot = T_Slot(t, i);
+    if (!bsearch(&hash_slot, slots, n_slots, sizeof(MU32), _mmc_cmp_mu32))
+      continue;
+    T_Tag(t, n_used) = T_Tag(t, i);
+    T_Slot(t, n_used) = hash_slot;
+    n_used++;
+  }
+  T_Count(t) = n_used;
 
-#ifdef DEBUG
-    /* Check hash actually matches stored value */
-    {
-      MU32 hash_page_dummy, hash_slot;
-      mmc_hash(cache, S_KeyPtr(old_base_det), S_KeyLen(old_base_det), &hash_page_dummy, &hash_slot);
+  free(slots);
+}
 
-      ASSERT(hash_slot == S_SlotHash(old_base_det));
-    }
-#endif
+/*
+ * int _mmc_tagged_at(mmap_cache * cache, MU32 hash_slot)
+ *
+ * Count the tagged items in the current page with the given hash
+ * slot, following the same linear probing as _mmc_find_slot()
+ *
+*/
+int _mmc_tagged_at(mmap_cache * cache, MU32 hash_slot) {
+  MU32 * slot_ptr = cache->p_base_slots + (hash_slot % cache->p_num_slots);
+  MU32 * slots_end = cache->p_base_slots + cache->p_num_slots;
+  MU32 slots_left = cache->p_num_slots;
+  int n_tagged = 0;
 
-    /* Find free slot */
-    new_slot_ptr = new_slot_data + slot;
-    while (*new_slot_ptr) {
-      if (++slot >= new_num_slots) { slot = 0; }
-      new_slot_ptr = new_slot_data + slot;
+  while (slots_left-- && *slot_ptr) {
+    if (*slot_ptr > 1) {
+      MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+      if (S_SlotHash(base_det) == hash_slot && (S_Flags(base_det) & MMC_TAGGED))
+        n_tagged++;
     }
+    if (++slot_ptr == slots_end) { slot_ptr = cache->p_base_slots; }
+  }
 
-    /* Copy slot and KV data */
-    kvlen = S_SlotLen(old_base_det);
-    memcpy(PTR_ADD(new_kv_data, new_offset), old_base_det, kvlen);
+  return n_tagged;
+}
 
-    /* Store slot data and mark as used */
-    *new_slot_ptr = new_offset + new_num_slots * 4 + P_HEADERSIZE;
+/*
+ * int mmc_tag_add(mmap_cache * cache, MU32 hash_slot, MU32 * tag_hashes, int n_tags)
+ *
+ * Add references to the tagged item at hash_slot in the current
+ * page (which should have the MMC_TAGGED flag) to the page's tag
+ * index, for each of the n_tags tag hashes from mmc_tag_hash().
+ * References left by earlier values of the item's key are removed
+ * first, so only its current tags invalidate it. When the index is
+ * full, references to items no longer tagged are removed too
+ *
+ * Returns 0 on success, -1 if the index is still full, in which
+ * case the item should be deleted, as it couldn't be invalidated
+ *
+*/
+int mmc_tag_add(mmap_cache * cache, MU32 hash_slot, MU32 * tag_hashes, int n_tags) {
+  volatile MU32 * t;
+  MU32 i;
+  int tag, swept = 0;
 
-    ROUNDLEN(kvlen);
-    new_offset += kvlen;
+  if (!cache->c_tag_slots)
+    return -1;
+  t = T_Seg(cache, cache->p_cur);
+
+  /* Drop references for the hash slot, unless another tagged item
+     in the page has the same hash slot, as they may be its own */
+  if (_mmc_tagged_at(cache, hash_slot) <= 1) {
+    MU32 n_used = 0;
+    for (i = 0; i < T_Count(t); i++) {
+      if (T_Slot(t, i) == hash_slot)
+        continue;
+      T_Tag(t, n_used) = T_Tag(t, i);
+      T_Slot(t, n_used) = T_Slot(t, i);
+      n_used++;
+    }
+    T_Count(t) = n_used;
   }
 
-  ASSERT(new_offset <= page_data_size);
+  for (tag = 0; tag < n_tags; tag++) {
 
-/*  printf("page=%d\n", cache->p_cur);
-  printf("old_slots=%d, new_slots=%d\n", old_num_slots, new_num_slots);
-  printf("old_used_slots=%d, new_used_slots=%d\n", old_used_slots, new_used_slots);*/
+    /* Already referenced, eg item set again with the same tags */
+    for (i = 0; i < T_Count(t); i++) {
+      if (T_Tag(t, i) == tag_hashes[tag] && T_Slot(t, i) == hash_slot)
+        break;
+    }
+    if (i < T_Count(t))
+      continue;
 
-  /* Store back into mmap'ed file space */
-  memcpy(base_slots, new_slot_data, slot_data_size);
-  memcpy(base_slots + new_num_slots, new_kv_data, new_offset);
+    if (T_Count(t) >= cache->c_tag_slots) {
+      if (swept++)
+        return -1;
+      _mmc_tag_sweep(cache);
+      if (T_Count(t) >= cache->c_tag_slots)
+        return -1;
+    }
 
-  cache->p_num_slots = new_num_slots;
-  cache->p_free_slots = new_num_slots - new_used_slots;
-  cache->p_old_slots = 0;
-  cache->p_free_data = new_offset + new_num_slots * 4 + P_HEADERSIZE;
-  cache->p_free_bytes = page_data_size - new_offset;
+    i = T_Count(t);
+    T_Tag(t, i) = tag_hashes[tag];
+    T_Slot(t, i) = hash_slot;
+    T_Count(t) = i + 1;
+  }
 
-  /* Make sure changes are saved back to mmap'ed file */
-  cache->p_changed = 1;
+  return 0;
+}
 
-  /* Free allocated memory */
-  free(new_kv_data);
-  free(new_slot_data);
-  free(to_expunge);
+/*
+ * int mmc_tag_in_page(mmap_cache * cache, MU32 page, MU32 tag_hash)
+ *
+ * Returns true if page's tag index has any references for tag_hash.
+ * Doesn't need any page locked, so a page may have changed by the
+ * time it's locked
+ *
+*/
+int mmc_tag_in_page(mmap_cache * cache, MU32 page, MU32 tag_hash) {
+  volatile MU32 * t;
+  MU32 i, n_used;
 
-  ASSERT(_mmc_test_page(cache));
+  if (!cache->c_tag_slots)
+    return 0;
+  t = T_Seg(cache, page);
+
+  n_used = T_Count(t);
+  if (n_used > cache->c_tag_slots)
+    n_used = cache->c_tag_slots;
+  for (i = 0; i < n_used; i++) {
+    if (T_Tag(t, i) == tag_hash)
+      return 1;
+  }
 
   return 0;
 }
 
 /*
- * void mmc_get_page_details(mmap_cache * cache, MU32 * n_reads, MU32 * n_read_hits)
+ * int mmc_tag_remove_page(mmap_cache * cache, MU32 tag_hash, MU32 *** removed)
  *
- * Return details about the current locked page. Currently just
- * number of reads and number of reads that hit
+ * Delete all tagged items in the current page that the tag index
+ * has references to for tag_hash, and remove those references.
+ * Items with a tag that hashes the same are deleted too. Sets
+ * *removed to a list of pointers to the items, which the caller
+ * must free(), and whose details can still be read with
+ * mmc_get_details() until anything else is done with the page
+ *
+ * Returns the number of items
  *
 */
-void mmc_get_page_details(mmap_cache * cache, MU32 * n_reads, MU32 * n_read_hits) {
-  *n_reads = cache->p_n_reads;
-  *n_read_hits = cache->p_n_read_hits;
-  return;
+int mmc_tag_remove_page(mmap_cache * cache, MU32 tag_hash, MU32 *** removed) {
+  volatile MU32 * t = T_Seg(cache, cache->p_cur);
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  MU32 * slots, i, n_used = 0;
+  MU32 ** items;
+  int n_slots = 0, n_items = 0;
+
+  *removed = items = (MU32 **)malloc(sizeof(MU32 *) * (cache->p_num_slots - cache->p_free_slots + 1));
+  if (!cache->c_tag_slots)
+    return 0;
+
+  /* Take the hash slots referenced for the tag out of the index */
+  slots = (MU32 *)malloc(sizeof(MU32) * (T_Count(t) + 1));
+  for (i = 0; i < T_Count(t); i++) {
+    if (T_Tag(t, i) == tag_hash) {
+      slots[n_slots++] = T_Slot(t, i);
+      continue;
+    }
+    T_Tag(t, n_used) = T_Tag(t, i);
+    T_Slot(t, n_used) = T_Slot(t, i);
+    n_used++;
+  }
+  T_Count(t) = n_used;
+  qsort(slots, n_slots, sizeof(MU32), _mmc_cmp_mu32);
+
+  /* And delete tagged items at those hash slots in one pass */
+  for (; n_slots && slot_ptr != slot_end; slot_ptr++) {
+    MU32 * base_det;
+    MU32 hash_slot;
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    hash_slot = S_SlotHash(base_det);
+    if (!(S_Flags(base_det) & MMC_TAGGED) ||
+        !bsearch(&hash_slot, slots, n_slots, sizeof(MU32), _mmc_cmp_mu32))
+      continue;
+
+    items[n_items++] = base_det;
+    _mmc_delete_slot(cache, slot_ptr);
+  }
+
+  free(slots);
+  return n_items;
 }
 
 /*
- * void mmc_reset_page_details(mmap_cache * cache)
+ * int mmc_match_page(mmap_cache * cache, void * pattern, int pattern_len, int delete, MU32 *** matches)
  *
- * Reset any page details (currently just read hits)
+ * Find all items in the current page with keys matching the given
+ * shell style pattern, where * matches any bytes, ? matches any
+ * one byte, [...] matches one byte in a set, and \ makes the next
+ * byte match literally. Keys are only compared as bytes, and the
+ * literal start of a pattern like "user:123:*" is just a memcmp.
+ * Sets *matches to a list of pointers to the items, which the
+ * caller must free(). If delete is set, the items are deleted,
+ * but their details can still be read with mmc_get_details()
+ * until anything else is done with the page
+ *
+ * Returns the number of items
  *
 */
-void mmc_reset_page_details(mmap_cache * cache) {
-  cache->p_n_reads = 0;
-  cache->p_n_read_hits = 0;
-  cache->p_changed = 1;
-  return;
+int mmc_match_page(mmap_cache * cache, void * pattern, int pattern_len, int delete, MU32 *** matches) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  const char * pat = (const char *)pattern;
+  MU32 ** items;
+  int n_items = 0, lit_len = 0, star_only;
+
+  /* Literal bytes at the start of the pattern */
+  while (lit_len < pattern_len && !strchr("*?[\\", pat[lit_len]))
+    lit_len++;
+
+  /* Literal followed by just a *, a prefix match */
+  star_only = lit_len == pattern_len - 1 && pat[lit_len] == '*';
+
+  *matches = items = (MU32 **)malloc(sizeof(MU32 *) * (cache->p_num_slots - cache->p_free_slots + 1));
+
+  for (; slot_ptr != slot_end; slot_ptr++) {
+    MU32 * base_det;
+    int key_len;
+    const char * key_ptr;
+
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    if (S_Flags(base_det) & MMC_LEASE)
+      continue;
+
+    key_len = (int)S_KeyLen(base_det);
+    key_ptr = (const char *)S_KeyPtr(base_det);
+    if (key_len < lit_len || memcmp(key_ptr, pat, lit_len) != 0)
+      continue;
+    if (lit_len == pattern_len && key_len != lit_len)
+      continue;
+    if (lit_len < pattern_len && !star_only &&
+        !_mmc_glob_match(pat + lit_len, pattern_len - lit_len, key_ptr + lit_len, key_len - lit_len))
+      continue;
+
+    items[n_items++] = base_det;
+    if (delete)
+      _mmc_delete_slot(cache, slot_ptr);
+  }
+
+  return n_items;
 }
 
 /*
@@ -846,12 +2528,64 @@ mmap_cache_it * mmc_iterate_new(mmap_cache * cache) {
   mmap_cache_it * it = (mmap_cache_it *)malloc(sizeof(mmap_cache_it));
   it->cache = cache;
   it->p_cur = -1;
+  it->p_end = cache->c_num_pages;
   it->slot_ptr = 0;
   it->slot_ptr_end = 0;
 
   return it;
 }
 
+/*
+ * mmap_cache_it * mmc_iterate_new_at(mmap_cache * cache, MU32 page, MU32 slot, MU32 end_page)
+ *
+ * Setup a new iterator to iterate over stored items, starting
+ * from the given slot of the given page, as returned by
+ * mmc_iterate_position(...) for an earlier iterator, and stopping
+ * before end_page. This allows separate processes to go through
+ * separate ranges of pages. The page must be less than end_page,
+ * and is locked straight away. Slots may have moved if the page
+ * changed in between, so some items might be skipped or returned
+ * again.
+ *
+*/
+mmap_cache_it * mmc_iterate_new_at(mmap_cache * cache, MU32 page, MU32 slot, MU32 end_page) {
+  mmap_cache_it * it = mmc_iterate_new(cache);
+
+  ASSERT(page < end_page && end_page <= cache->c_num_pages);
+
+  mmc_lock(cache, page);
+  it->p_cur = page;
+  it->p_end = end_page;
+
+  /* Page might have fewer slots than before */
+  if (slot > cache->p_num_slots)
+    slot = cache->p_num_slots;
+  it->slot_ptr = cache->p_base_slots + slot;
+  it->slot_ptr_end = cache->p_base_slots + cache->p_num_slots;
+
+  return it;
+}
+
+/*
+ * void mmc_iterate_position(mmap_cache_it * it, MU32 * page, MU32 * slot)
+ *
+ * Return the page and slot the next mmc_iterate_next(...) call
+ * would continue from, to resume later with mmc_iterate_new_at(...).
+ * The page is the end page once all items have been returned.
+ *
+*/
+void mmc_iterate_position(mmap_cache_it * it, MU32 * page, MU32 * slot) {
+  mmap_cache * cache = it->cache;
+
+  if (it->p_cur == -1) {
+    *page = it->slot_ptr_end ? it->p_end : 0;
+    *slot = 0;
+  } else {
+    *page = it->p_cur;
+    *slot = (MU32)(it->slot_ptr - cache->p_base_slots);
+  }
+}
+
 /*
  * MU32 * mmc_iterate_next(mmap_cache_it * it)
  *
@@ -866,8 +2600,9 @@ MU32 * mmc_iterate_next(mmap_cache_it * it) {
   MU32 * slot_ptr = it->slot_ptr;
   MU32 * base_det;
 
-  /* If empty slot, keep moving till we find a used one */
-  while (slot_ptr == it->slot_ptr_end || *slot_ptr <= 1) {
+  /* If empty slot or lease, keep moving till we find a used one */
+  while (slot_ptr == it->slot_ptr_end || *slot_ptr <= 1 ||
+      (S_Flags(S_Ptr(cache->p_base, *slot_ptr)) & MMC_LEASE)) {
 
     /* End of page ... */
     if (slot_ptr == it->slot_ptr_end) {
@@ -878,7 +2613,7 @@ MU32 * mmc_iterate_next(mmap_cache_it * it) {
       }
 
       /* Move to the next page, return 0 if no more pages */
-      if (++it->p_cur == cache->c_num_pages) {
+      if (++it->p_cur == it->p_end) {
         it->p_cur = -1;
         it->slot_ptr = 0;
         return 0;
@@ -937,7 +2672,8 @@ void mmc_iterate_close(mmap_cache_it * it) {
  * Given a base_det pointer to entries details
  * (as returned by mmc_iterate_next(...) and
  * mmc_calc_expunge(...)) return details of that
- * entry in the cache
+ * entry in the cache. Items whose namespace has been
+ * bumped are returned as already expired
  *
 */
 void mmc_get_details(
@@ -947,8 +2683,6 @@ void mmc_get_details(
   void ** val_ptr, int * val_len,
   MU32 * last_access, MU32 * expire_time, MU32 * flags
 ) {
-  cache = cache;
-
   *key_ptr = S_KeyPtr(base_det);
   *key_len = S_KeyLen(base_det);
 
@@ -956,8 +2690,8 @@ void mmc_get_details(
   *val_len = S_ValLen(base_det);
 
   *last_access = S_LastAccess(base_det);
-  *expire_time = S_ExpireTime(base_det);
-  *flags = S_Flags(base_det);
+  *expire_time = S_NsBumped(cache, base_det) ? 1 : S_ExpireTime(base_det);
+  *flags = S_Flags(base_det) & ~MMC_REFRESHING;
 }
 
 
@@ -975,6 +2709,10 @@ void _mmc_delete_slot(
   ASSERT(*slot_ptr > 1);
   ASSERT(cache->p_cur != -1);
 
+  /* One less dirty item */
+  if (S_Flags(S_Ptr(cache->p_base, *slot_ptr)) & MMC_DIRTY)
+    cache->p_n_dirty--;
+
   /* Set offset to 1 */
   *slot_ptr = 1;
 
@@ -986,6 +2724,138 @@ void _mmc_delete_slot(
   cache->p_changed = 1;
 }
 
+/*
+ * void _mmc_set_flags(
+ *   mmap_cache * cache, MU32 * base_det, MU32 flags
+ * )
+ *
+ * Change the flags of an item in the current page, keeping the
+ * dirty item count right
+ *
+*/
+void _mmc_set_flags(
+  mmap_cache * cache, MU32 * base_det, MU32 flags
+) {
+  if ((S_Flags(base_det) & MMC_DIRTY) && !(flags & MMC_DIRTY))
+    cache->p_n_dirty--;
+  if (!(S_Flags(base_det) & MMC_DIRTY) && (flags & MMC_DIRTY))
+    cache->p_n_dirty++;
+
+  S_Flags(base_det) = flags;
+  cache->p_changed = 1;
+}
+
+/*
+ * MU32 _mmc_get_slack(MU32 * base_det)
+ *
+ * Number of spare bytes after the value of an item with the
+ * MMC_SLACK flag, stored at the start of the spare bytes
+ *
+*/
+MU32 _mmc_get_slack(MU32 * base_det) {
+  MU32 slack;
+  memcpy(&slack, PTR_ADD(S_ValPtr(base_det), S_ValLen(base_det)), sizeof(MU32));
+  return slack;
+}
+
+/*
+ * void _mmc_set_slack(MU32 * base_det, MU32 slack)
+ *
+ * Record the number of spare bytes after the value of an item.
+ * Items always end on a 4 byte boundary, so fewer than 4 spare
+ * bytes are just part of the item's rounding and aren't recorded
+ *
+*/
+void _mmc_set_slack(MU32 * base_det, MU32 slack) {
+  if (slack < sizeof(MU32)) {
+    S_Flags(base_det) &= ~MMC_SLACK;
+    return;
+  }
+  S_Flags(base_det) |= MMC_SLACK;
+  memcpy(PTR_ADD(S_ValPtr(base_det), S_ValLen(base_det)), &slack, sizeof(MU32));
+}
+
+/*
+ * MU32 _mmc_rand(mmap_cache * cache)
+ *
+ * Return next value from a cheap per cache xorshift random
+ * number generator. Only used to spread out expiry times
+ *
+*/
+MU32 _mmc_rand(mmap_cache * cache) {
+  MU32 x = cache->c_rand;
+  if (!x) x = 0x2545f491;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return (cache->c_rand = x);
+}
+
+/*
+ * MU32 _mmc_recompute_bits(MU32 recompute_ms)
+ *
+ * Entry flag bits for a recompute time, stored as 1 + 8*log2(ms)
+ * so it fits in 8 bits and is still within about 5% of the time
+ * given. 0 means unknown
+ *
+*/
+MU32 _mmc_recompute_bits(MU32 recompute_ms) {
+  double code;
+
+  if (!recompute_ms)
+    return 0;
+
+  code = 1.0 + floor(8.0 * log((double)recompute_ms) / log(2.0) + 0.5);
+  if (code > 255.0)
+    code = 255.0;
+
+  return (MU32)code << MMC_RECOMPUTE_SHIFT;
+}
+
+/*
+ * MU32 _mmc_jitter(mmap_cache * cache, MU32 seconds)
+ *
+ * Reduce an expiry time in seconds by a random amount up to the
+ * expire_jitter percentage of it, but never to less than 1
+ *
+*/
+MU32 _mmc_jitter(mmap_cache * cache, MU32 seconds) {
+  MU32 range = (MU32)(((MU64)seconds * cache->expire_jitter) / 100);
+  if (!seconds || !range)
+    return seconds;
+  seconds -= _mmc_rand(cache) % (range + 1);
+  return seconds ? seconds : 1;
+}
+
+/*
+ * int _mmc_early_expire(mmap_cache * cache, MU32 * base_det, MU32 now)
+ *
+ * Decide if an item should be treated as expired early, with a
+ * probability that rises as its expiry time gets closer. This is
+ * the XFetch algorithm, where an item is expired early if
+ *
+ *   now - recompute * beta * log(rand()) >= expire_time
+ *
+ * so items that take longer to recalculate are refreshed earlier.
+ * early_expire_beta is in thousandths
+ *
+*/
+int _mmc_early_expire(mmap_cache * cache, MU32 * base_det, MU32 now) {
+  MU32 expire_time = S_ExpireTime(base_det);
+  MU32 recompute = S_Recompute(base_det);
+  double r, gap;
+
+  if (!expire_time || !recompute || now >= expire_time)
+    return 0;
+
+  /* Uniform in (0, 1], so log() is finite */
+  r = (double)((_mmc_rand(cache) >> 8) + 1) / (double)(1 << 24);
+  gap = -log(r) * pow(2.0, (double)(recompute - 1) / 8.0) / 1000.0
+    * (double)cache->early_expire_beta / 1000.0;
+
+  return (double)now + gap >= (double)expire_time;
+}
+
 /*
  * MU32 * _mmc_find_slot(
  *   mmap_cache * cache, MU32 hash_slot,
@@ -1017,7 +2887,7 @@ MU32 * _mmc_find_slot(
   while (slots_left--) {
     MU32 data_offset = *slot_ptr;
     ASSERT(data_offset == 0 || data_offset == 1 ||
-        ((data_offset >= P_HEADERSIZE + cache->p_num_slots*4) &&
+        ((data_offset >= P_HeaderSize(cache) + cache->p_num_slots*4) &&
          (data_offset < cache->c_page_size) &&
          ((data_offset & 3) == 0)));
 
@@ -1062,6 +2932,94 @@ MU32 * _mmc_find_slot(
     return 0;
 }
 
+/*
+ * int _mmc_glob_one(const char * pat, int pat_len, int * p, char c)
+ *
+ * Match byte c against the single pattern element at *p (a
+ * literal byte, ?, \ escape or [...] set), and move *p past it
+ *
+*/
+int _mmc_glob_one(const char * pat, int pat_len, int * p, char c) {
+  int i = *p, negate = 0, found = 0;
+
+  if (pat[i] == '?') {
+    *p = i + 1;
+    return 1;
+  }
+
+  if (pat[i] == '\\' && i + 1 < pat_len) {
+    *p = i + 2;
+    return pat[i + 1] == c;
+  }
+
+  if (pat[i] == '[') {
+    int j = i + 1;
+    if (j < pat_len && (pat[j] == '!' || pat[j] == '^')) {
+      negate = 1;
+      j++;
+    }
+
+    /* A ] straight after the [ is part of the set */
+    for (; j < pat_len && (pat[j] != ']' || j == i + 1 + negate); j++) {
+      if (j + 2 < pat_len && pat[j + 1] == '-' && pat[j + 2] != ']') {
+        if ((unsigned char)c >= (unsigned char)pat[j] && (unsigned char)c <= (unsigned char)pat[j + 2])
+          found = 1;
+        j += 2;
+      } else if (pat[j] == c) {
+        found = 1;
+      }
+    }
+
+    /* Set closed, otherwise the [ is just a literal */
+    if (j < pat_len) {
+      *p = j + 1;
+      return found != negate;
+    }
+  }
+
+  *p = i + 1;
+  return pat[i] == c;
+}
+
+/*
+ * int _mmc_glob_match(const char * pat, int pat_len, const char * str, int str_len)
+ *
+ * Return true if the whole of str matches the shell style pattern
+ * (see mmc_match_page()). Neither needs to be nul terminated
+ *
+*/
+int _mmc_glob_match(const char * pat, int pat_len, const char * str, int str_len) {
+  int p = 0, s = 0, star_p = -1, star_s = 0;
+
+  while (s < str_len) {
+    int next = p;
+
+    /* Remember the last * so we can backtrack to it */
+    if (p < pat_len && pat[p] == '*') {
+      star_p = ++p;
+      star_s = s;
+      continue;
+    }
+
+    if (p < pat_len && _mmc_glob_one(pat, pat_len, &next, str[s])) {
+      p = next;
+      s++;
+      continue;
+    }
+
+    /* Mismatch, let the last * match one more byte */
+    if (star_p == -1)
+      return 0;
+    p = star_p;
+    s = ++star_s;
+  }
+
+  while (p < pat_len && pat[p] == '*')
+    p++;
+
+  return p == pat_len;
+}
+
 /*
  * void _mmc_init_page(mmap_cache * cache, int page)
  *
@@ -1086,17 +3044,37 @@ void _mmc_init_page(mmap_cache * cache, MU32 p_cur) {
     memset(p_ptr, 0, cache->c_page_size);
 
     /* Setup header */
-    P_Magic(p_ptr) = 0x92f7e3b1;
+    P_Magic(p_ptr) = P_MAGIC;
     P_NumSlots(p_ptr) = cache->start_slots;
     P_FreeSlots(p_ptr) = cache->start_slots;
     P_OldSlots(p_ptr) = 0;
-    P_FreeData(p_ptr) = P_HEADERSIZE + cache->start_slots * 4;
+    P_FreeData(p_ptr) = P_HeaderSize(cache) + cache->start_slots * 4;
     P_FreeBytes(p_ptr) = cache->c_page_size - P_FreeData(p_ptr);
     P_NReads(p_ptr) = 0;
     P_NReadHits(p_ptr) = 0;
+    P_Cas(p_ptr) = 0;
+    D_Count(cache, p_cur) = 0;
   }
 }
 
+/*
+ * void _mmc_init_queue(mmap_cache * cache)
+ *
+ * Initialise the write behind queue as empty
+ *
+*/
+void _mmc_init_queue(mmap_cache * cache) {
+  void * q_ptr = Q_Base(cache);
+
+  memset(q_ptr, 0, cache->c_queue_size);
+
+  Q_Magic(q_ptr) = Q_MAGIC;
+  Q_Size(q_ptr) = cache->c_queue_size - Q_HEADERSIZE - Q_BloomLen(cache);
+  Q_Head(q_ptr) = 0;
+  Q_Tail(q_ptr) = 0;
+  Q_Count(q_ptr) = 0;
+}
+
 /*
  * int _mmc_test_page(mmap_cache * cache)
  *
@@ -1115,10 +3093,10 @@ int  _mmc_test_page(mmap_cache * cache) {
     MU32 data_offset = *slot_ptr;
 
     ASSERT(data_offset == 0 || data_offset == 1 ||
-        (data_offset >= P_HEADERSIZE + cache->p_num_slots * 4 &&
+        (data_offset >= P_HeaderSize(cache) + cache->p_num_slots * 4 &&
          data_offset < cache->c_page_size));
     if (!(data_offset == 0 || data_offset == 1 ||
-        (data_offset >= P_HEADERSIZE + cache->p_num_slots * 4 &&
+        (data_offset >= P_HeaderSize(cache) + cache->p_num_slots * 4 &&
          data_offset < cache->c_page_size))) return 0;
 
     if (data_offset == 1) {
@@ -87,7 +87,7 @@
  * 
  * The layout of each page is:
  * 
- * - Magic (4 bytes) - 0x92f7e3b1 magic page start marker
+ * - Magic (4 bytes) - 0x92f7e3ba magic page start marker
  *
  * - NumSlots (4 bytes) - Number of hash slots in this page
  *
@@ -107,6 +107,13 @@
  *
  * - N Read Hits (4 bytes) - Number of reads on this page that have hit
  *   something in the cache
+ *
+ * - Cas (4 bytes) - Last CAS value given to an item in this page
+ *
+ * - Bloom (PageSize / 256 bytes) - Bloom filter of the hash values
+ *   of keys in this page, so reads of missing keys can return without locking
+ *   the page. Bits are set on each write, and the whole filter is
+ *   rebuilt on each expunge run
  * 
  * - Slots (4 bytes * NumSlots) - Hash slots
  *
@@ -129,15 +136,63 @@
  * - HashValue (4 bytes) - Value key was hashed to, so we don't have to
  *   rehash on a re-organisation of the hash table
  *
- * - Flags (4 bytes) - Various flags
+ * - Flags (4 bytes) - Various flags, also holding the time the value
+ *   took to calculate, used to decide when to expire it early (see
+ *   MMC_RECOMPUTE_MASK)
  * 
  * - KeyLen (4 bytes) - Length of key
  * 
  * - ValueLen (4 bytes) - Length of value
+ *
+ * - Cas (4 bytes) - Value from the page's CAS counter, changed on
+ *   each write of the item, so compare and swap writes can tell if
+ *   it's been changed
+ *
+ * - SoftExpire (4 bytes) - Unix time data becomes stale. Stale data
+ *   is still returned (flagged as stale) till ExpireTime, and one
+ *   reader at a time is given the job of refreshing it. Only items
+ *   with the MMC_SOFT flag have this word
+ *
+ * - NsGen (4 bytes) - Generation of the item's namespace when it
+ *   was written. Only items in a namespace have this word
  * 
  * - Key (KeyLen bytes) - Key data
  * 
  * - Value (ValueLen bytes) - Value data
+ *
+ * - Slack (Slack bytes) - Reserved space, only on items with the
+ *   MMC_SLACK flag, whose first 4 bytes hold the number of bytes
+ *
+ * The pages are followed by the dirty item counts of each page,
+ * 4 bytes for each page, of items with the MMC_DIRTY flag set.
+ * This means pages with dirty items can be found without locking
+ * and searching every page.
+ *
+ * If a write behind queue size is set, that's followed by
+ * a ring buffer of dirty items pushed out of pages to make space,
+ * waiting to be written back to the underlying store. It has its
+ * own lock, and is made of:
+ *
+ * - Magic (4 bytes) - 0x92f7e4a3 magic queue start marker
+ *
+ * - Size (4 bytes) - Bytes of queue data
+ *
+ * - Head (4 bytes) - Offset in queue data of oldest item
+ *
+ * - Tail (4 bytes) - Offset in queue data to add next item
+ *
+ * - Count (4 bytes) - Number of items in queue
+ *
+ * - Data (Size bytes) - Items, each made of Len, ExpireTime,
+ *   Flags, KeyLen, ValueLen, NTags (4 bytes each), NTags tag
+ *   hashes (4 bytes each), key and value data. A Len of 0 means
+ *   the rest of the queue data is unused, and the next item is
+ *   at the start. Items removed before being written back have
+ *   MMC_DIRTY cleared in Flags
+ *
+ * - Bloom (1 byte for every 8 bytes of queue) - Counting bloom
+ *   filter of the hash slots of the keys of items in the queue, so
+ *   looking for a key that isn't queued doesn't search the queue
  * 
  * Each set/get/delete operation involves:
  * 
@@ -181,6 +236,88 @@ typedef struct mmap_cache_it mmap_cache_it;
 /* Unsigned 32 bit integer */
 typedef unsigned int MU32;
 
+/* Signed 64 bit integer */
+#ifdef WIN32
+typedef __int64 MI64;
+#else
+typedef long long MI64;
+#endif
+
+/* Unsigned 64 bit integer */
+#ifdef WIN32
+typedef unsigned __int64 MU64;
+#else
+typedef unsigned long long MU64;
+#endif
+
+/* Entry flag for values that are a native 64 bit counter (see
+ * mmc_incr()). The top 3 bits are used by FastMmap.xs, and the
+ * bottom bits by FastMmap.pm */
+#define MMC_COUNTER (1<<28)
+
+/* Entry flag for values FastMmap.xs stored as a native 64 bit
+ * integer (FC_IVVAL), which mmc_incr() turns into a counter */
+#define MMC_IVVAL (1<<22)
+
+/* Entry flag for items changed since they were read from the
+ * underlying store (FC_ISDIRTY in FastMmap.pm). These are counted
+ * for each page (see mmc_dirty_pages()) */
+#define MMC_DIRTY (1<<0)
+
+/* Entry flag for lease placeholders (see mmc_lease()). These are
+ * never returned as values */
+#define MMC_LEASE (1<<27)
+
+/* Flag returned by reads of stale entries, never stored */
+#define MMC_STALE (1<<26)
+
+/* Entry flag for stale entries being refreshed (see mmc_refresh()) */
+#define MMC_REFRESHING (1<<25)
+
+/* Flag returned by reads of entries chosen to expire early, never stored */
+#define MMC_EARLY (1<<24)
+
+/* Entry flag bits holding the namespace of an entry, 0 for none
+ * (see mmc_ns_flags()) */
+#define MMC_NS_SHIFT 1
+#define MMC_NS_MASK (0xff<<MMC_NS_SHIFT)
+
+/* Entry flag bits holding the time taken to calculate the value,
+ * on a log scale, 0 if unknown (see _mmc_recompute_bits()) */
+#define MMC_RECOMPUTE_SHIFT 12
+#define MMC_RECOMPUTE_MASK (0xff<<MMC_RECOMPUTE_SHIFT)
+
+/* Entry flag for items with references in their page's tag index
+ * (see mmc_tag_add()) */
+#define MMC_TAGGED (1<<9)
+
+/* Entry flag for items with spare bytes reserved after the value,
+ * so appends can grow it in place. The number of spare bytes is
+ * stored at the start of the spare space */
+#define MMC_SLACK (1<<10)
+
+/* Entry flag for items with a soft expiry time word */
+#define MMC_SOFT (1<<11)
+
+/* Entry flags that describe how the entry itself is stored, so are
+ * kept when other flags are changed. Only mmc_write_ext() sets them,
+ * from its arguments and the namespace of the flags it's given */
+#define MMC_LAYOUT_FLAGS (MMC_NS_MASK | MMC_RECOMPUTE_MASK | MMC_SLACK | MMC_SOFT)
+
+/* Mode bits for mmc_append() */
+#define MMC_PREPEND  1
+#define MMC_EXISTING 2
+
+/* Modes for mmc_queue_remove() */
+#define MMC_QUEUE_ALL  0
+#define MMC_QUEUE_KEY  1
+#define MMC_QUEUE_GLOB 2
+#define MMC_QUEUE_NS   3
+#define MMC_QUEUE_TAG  4
+
+/* Callback passed value data by mmc_read_stream() */
+typedef int (*mmc_read_fn)(void * ctx, void * val_ptr, int val_len, MU32 flags);
+
 /* Initialisation/closing/error functions */
 mmap_cache * mmc_new();
 int mmc_init(mmap_cache *);
@@ -191,21 +328,66 @@ char * mmc_error(mmap_cache *);
 
 /* Functions for find/locking a page */
 int mmc_hash(mmap_cache *, void *, int, MU32 *, MU32 *);
+int mmc_bloom_check(mmap_cache *, MU32, MU32);
 int mmc_lock(mmap_cache *, MU32);
 int mmc_unlock(mmap_cache *);
 int mmc_is_locked(mmap_cache *);
 
 /* Functions for getting/setting/deleting values in current page */
 int mmc_read(mmap_cache *, MU32, void *, int, void **, int *, MU32 *);
+int mmc_read_cas(mmap_cache *, MU32, void *, int, void **, int *, MU32 *, MU32 *);
+int mmc_read_stream(mmap_cache *, MU32, void *, int, mmc_read_fn, void *);
+int mmc_read_copy(mmap_cache *, MU32, void *, int, void *, int, int *, MU32 *);
+int mmc_read_range(mmap_cache *, MU32, void *, int, int, int, void **, int *, MU32 *);
+int mmc_clip_range(int, int *, int);
+int mmc_exists(mmap_cache *, MU32, void *, int, MU32 *, int *);
 int mmc_write(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32);
+int mmc_write_ext(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32, MU32, MU32);
+int mmc_check_cas(mmap_cache *, MU32, void *, int, MU32);
 int mmc_delete(mmap_cache *, MU32, void *, int, MU32 *);
+int mmc_touch(mmap_cache *, MU32, void *, int, MU32);
+int mmc_lease(mmap_cache *, MU32, void *, int, MU32);
+int mmc_lease_release(mmap_cache *, MU32, void *, int);
+int mmc_refresh(mmap_cache *, MU32, void *, int, MU32);
+int mmc_append(mmap_cache *, MU32, void *, int, void *, int, int, MU32, MU32, int *);
+int mmc_incr(mmap_cache *, MU32, void *, int, MI64, MI64, MU32, MU32, MI64 *);
 
 /* Functions of expunging values in current page */
 int mmc_calc_expunge(mmap_cache *, int, int, MU32 *, MU32 ***);
+int mmc_calc_expunge_many(mmap_cache *, int, int, int, MU32 *, MU32 ***);
 int mmc_do_expunge(mmap_cache *, int, MU32, MU32 **);
 
+/* Functions for the write behind queue of dirty items */
+int mmc_queue_lock(mmap_cache *);
+int mmc_queue_unlock(mmap_cache *);
+int mmc_queue_push(mmap_cache *, void *, int, void *, int, MU32, MU32);
+int mmc_queue_pop(mmap_cache *, void **, int *, void **, int *, MU32 *, MU32 *);
+int mmc_queue_find(mmap_cache *, void *, int, void **, int *, MU32 *, MU32 *);
+int mmc_queue_remove(mmap_cache *, int, void *, int, MU32, MU32, MU32);
+int mmc_queue_maybe(mmap_cache *, void *, int);
+int mmc_queue_count(mmap_cache *);
+
+/* Functions for finding dirty items */
+int mmc_dirty_pages(mmap_cache *, MU32 *);
+int mmc_clean_page(mmap_cache *, MU32 ***);
+
+/* Functions for namespace generations */
+MU32 mmc_ns_flags(mmap_cache *, void *, int);
+MU32 mmc_ns_bump(mmap_cache *, MU32);
+
+/* Functions for the tag index */
+MU32 mmc_tag_hash(void *, int);
+int mmc_tag_add(mmap_cache *, MU32, MU32 *, int);
+int mmc_tag_in_page(mmap_cache *, MU32, MU32);
+int mmc_tag_remove_page(mmap_cache *, MU32, MU32 ***);
+
+/* Functions for finding items by key pattern */
+int mmc_match_page(mmap_cache *, void *, int, int, MU32 ***);
+
 /* Functions for iterating over items in a cache */
 mmap_cache_it * mmc_iterate_new(mmap_cache *);
+mmap_cache_it * mmc_iterate_new_at(mmap_cache *, MU32, MU32, MU32);
+void mmc_iterate_position(mmap_cache_it *, MU32 *, MU32 *);
 MU32 * mmc_iterate_next(mmap_cache_it *);
 void mmc_iterate_close(mmap_cache_it *);
 
@@ -217,9 +399,27 @@ void mmc_reset_page_details(mmap_cache * cache);
 /* Internal functions */
 int _mmc_set_error(mmap_cache *, int, char *, ...);
 void _mmc_init_page(mmap_cache *, MU32);
+void _mmc_init_queue(mmap_cache *);
+void _mmc_queue_bloom(mmap_cache *, MU32, int);
+void _mmc_queue_bloom_key(mmap_cache *, void *, int, int);
 
 MU32 * _mmc_find_slot(mmap_cache * , MU32 , void *, int, int );
 void _mmc_delete_slot(mmap_cache * , MU32 *);
+void _mmc_set_flags(mmap_cache * , MU32 *, MU32);
+MU32 _mmc_get_slack(MU32 *);
+void _mmc_set_slack(MU32 *, MU32);
+
+MU32 _mmc_rand(mmap_cache *);
+MU32 _mmc_jitter(mmap_cache *, MU32);
+MU32 _mmc_recompute_bits(MU32);
+int  _mmc_ns_expire(mmap_cache *, MU32);
+int  _mmc_early_expire(mmap_cache *, MU32 *, MU32);
+int  _mmc_glob_one(const char *, int, int *, char);
+int  _mmc_glob_match(const char *, int, const char *, int);
+int  _mmc_cmp_mu32(const void *, const void *);
+int  _mmc_tagged_slots(mmap_cache *, MU32 **);
+int  _mmc_tagged_at(mmap_cache *, MU32);
+void _mmc_tag_sweep(mmap_cache *);
 
 int _mmc_check_expunge(mmap_cache * , int);
 
@@ -28,6 +28,8 @@ struct mmap_cache {
   MU32    p_free_bytes;
   MU32    p_n_reads;
   MU32    p_n_read_hits;
+  MU32    p_cas;
+  MU32    p_n_dirty;
 
   int    p_changed;
 
@@ -35,6 +37,25 @@ struct mmap_cache {
   MU32    c_num_pages;
   MU32    c_page_size;
   MU32    c_size;
+  MU32    c_bloom_words;
+
+  /* Dirty item counts of each page after the pages */
+  MU32    c_dirty_offset;
+
+  /* Write behind queue after that, if any */
+  MU32    c_queue_offset;
+  MU32    c_queue_size;
+
+  /* Namespace generations after that, if any */
+  MU32    c_ns_offset;
+  MU32    c_num_ns;
+
+  /* Tag index for each page after that, if any */
+  MU32    c_tag_offset;
+  MU32    c_tag_slots;
+
+  /* Random state for expiry jitter/early expiry */
+  MU32    c_rand;
 
   /* Pointer to mmapped area */
   void * mm_var;
@@ -42,6 +63,9 @@ struct mmap_cache {
   /* Cache general details */
   MU32    start_slots;
   MU32    expire_time;
+  MU32    soft_expire_time;
+  MU32    expire_jitter;
+  MU32    early_expire_beta;
   int     catch_deadlocks;
   int     enable_stats;
 
@@ -64,6 +88,7 @@ struct mmap_cache {
 struct mmap_cache_it {
   mmap_cache * cache;
   MU32         p_cur;
+  MU32         p_end;
   MU32 *       slot_ptr;
   MU32 *       slot_ptr_end;
 };
@@ -79,8 +104,26 @@ struct mmap_cache_it {
 #define P_FreeBytes(p) (*(PP(p)+5))
 #define P_NReads(p) (*(PP(p)+6))
 #define P_NReadHits(p) (*(PP(p)+7))
+#define P_Cas(p) (*(PP(p)+8))
+#define P_Bloom(p) (PP(p)+9)
+
+/* Header is followed by a bloom filter of c_bloom_words words */
+#define P_HeaderSize(c) (36 + (c)->c_bloom_words * 4)
+
+/* Magic page start marker, changed whenever the layout changes */
+#define P_MAGIC 0x92f7e3ba
 
-#define P_HEADERSIZE 32
+/* Dirty item count for each page, kept together outside the pages
+ * so pages with dirty items can be found without locking them. A
+ * whole word each so each page only updates its own count, under
+ * its own lock */
+#define D_Count(c,p)    (((volatile MU32 *)PTR_ADD((c)->mm_var, (c)->c_dirty_offset))[p])
+
+/* Bloom filter bit positions for a hash slot value in n bits */
+#define BLOOM_H1(h,n) ((h) % (n))
+#define BLOOM_H2(h,n) (((MU32)((h) * 0x9e3779b1) >> 11) % (n))
+#define BLOOM_SET(b,n) ((b)[(n) >> 5] |= (1U << ((n) & 31)))
+#define BLOOM_TEST(b,n) ((b)[(n) >> 5] & (1U << ((n) & 31)))
 
 /* Macros to access cache slot entries */
 #define SP(s) ((MU32 *)s)
@@ -97,13 +140,92 @@ struct mmap_cache_it {
 #define S_Flags(s)      (*(s+3))
 #define S_KeyLen(s)     (*(s+4))
 #define S_ValLen(s)     (*(s+5))
+#define S_Cas(s)        (*(s+6))
+
+/* Optional words, only present when the item's flags say so */
+#define S_SoftExpire(s) (*(s+7))
+#define S_NsGen(s)      (*(s+7+(S_Flags(s) & MMC_SOFT ? 1 : 0)))
+
+/* Number of header words an item with the given flags has */
+#define F_HdrWords(f)   (7 + ((f) & MMC_SOFT ? 1 : 0) + ((f) & MMC_NS_MASK ? 1 : 0))
+#define S_HdrWords(s)   F_HdrWords(S_Flags(s))
 
-#define S_KeyPtr(s)     ((void *)(s+6))
-#define S_ValPtr(s)     (PTR_ADD((void *)(s+6), S_KeyLen(s)))
+#define S_KeyPtr(s)     ((void *)(s+S_HdrWords(s)))
+#define S_ValPtr(s)     (PTR_ADD((void *)(s+S_HdrWords(s)), S_KeyLen(s)))
+
+/* Spare bytes reserved after the value for appends, only items
+ * with MMC_SLACK have any (see _mmc_get_slack()) */
+#define S_Slack(s)      ((S_Flags(s) & MMC_SLACK) ? _mmc_get_slack(s) : 0)
+
+/* Give the next CAS value of the current page to an item. CAS
+ * values only need to differ between writes of an item, so 32
+ * bits per page is plenty. 0 means no item, so is skipped */
+#define CAS_Next(c,s)   (S_Cas(s) = ++(c)->p_cas ? (c)->p_cas : ++(c)->p_cas)
 
 /* Length of slot data including key and value data */
-#define S_SlotLen(s)    (sizeof(MU32)*6 + S_KeyLen(s) + S_ValLen(s))
-#define KV_SlotLen(k,v) (sizeof(MU32)*6 + k + v)
+#define S_SlotLen(s)    (sizeof(MU32)*S_HdrWords(s) + S_KeyLen(s) + S_ValLen(s) + S_Slack(s))
+#define KV_SlotLen(f,k,v) (sizeof(MU32)*F_HdrWords(f) + k + v)
+
+/* Item is past its soft expiry time, or someone's refreshing it */
+#define S_IsStale(s,now) ((S_Flags(s) & MMC_REFRESHING) || ((S_Flags(s) & MMC_SOFT) && (now) > S_SoftExpire(s)))
+
+/* Recompute time of an item as stored (see _mmc_recompute_bits()) */
+#define S_Recompute(s)   ((S_Flags(s) & MMC_RECOMPUTE_MASK) >> MMC_RECOMPUTE_SHIFT)
+#define S_NsId(s)        ((S_Flags(s) & MMC_NS_MASK) >> MMC_NS_SHIFT)
+
+/* Current generation of namespace n (from 1) */
+#define NS_Gen(c,n)      (((volatile MU32 *)PTR_ADD((c)->mm_var, (c)->c_ns_offset))[(n) - 1])
+
+/* Item's namespace has been bumped since it was written */
+#define S_NsBumped(c,s)  (S_NsId(s) && (S_NsId(s) > (c)->c_num_ns || NS_Gen(c, S_NsId(s)) != S_NsGen(s)))
+
+/* Item is past its expiry time, or its namespace was bumped */
+#define S_IsExpired(c,s,now) ((S_ExpireTime(s) && (now) > S_ExpireTime(s)) || S_NsBumped(c,s))
+
+/* Tag index of page p, a count of used references followed by
+ * c_tag_slots references, each a tag hash and the hash slot of a
+ * tagged item in the page. Only changed with page p locked */
+#define T_SegSize(c)     (4 + (c)->c_tag_slots * 8)
+#define T_Seg(c,p)       ((volatile MU32 *)PTR_ADD((c)->mm_var, (c)->c_tag_offset + (p) * T_SegSize(c)))
+#define T_Count(t)       (*(t))
+#define T_Tag(t,i)       ((t)[1 + (i) * 2])
+#define T_Slot(t,i)      ((t)[2 + (i) * 2])
+
+/* Macros to access the write behind queue header and entries */
+#define Q_Base(c)       PTR_ADD((c)->mm_var, (c)->c_queue_offset)
+
+#define Q_Magic(q)      (*(PP(q)+0))
+#define Q_Size(q)       (*(PP(q)+1))
+#define Q_Head(q)       (*(PP(q)+2))
+#define Q_Tail(q)       (*(PP(q)+3))
+#define Q_Count(q)      (*(PP(q)+4))
+#define Q_Data(q)       PTR_ADD(q, Q_HEADERSIZE)
+
+#define Q_HEADERSIZE 20
+#define Q_MAGIC 0x92f7e4a3
+
+/* Counting bloom filter of the keys of items in the queue, one
+ * byte counter for every 8 bytes of queue, after the queue data.
+ * Counters that reach 255 stay there till the queue is empty */
+#define Q_BloomLen(c)   (((c)->c_queue_size / 8) & ~3)
+#define Q_Bloom(q)      ((unsigned char *)PTR_ADD(q, Q_HEADERSIZE + Q_Size(q)))
+
+#define QE_Len(e)        (*(e+0))
+#define QE_ExpireTime(e) (*(e+1))
+#define QE_Flags(e)      (*(e+2))
+#define QE_KeyLen(e)     (*(e+3))
+#define QE_ValLen(e)     (*(e+4))
+#define QE_NTags(e)      (*(e+5))
+#define QE_TagPtr(e)     (e+6)
+#define QE_KeyPtr(e)     ((void *)(e+6+QE_NTags(e)))
+#define QE_ValPtr(e)     (PTR_ADD(QE_KeyPtr(e), QE_KeyLen(e)))
+
+#define QE_HEADERSIZE 24
+
+/* Queue items are always dirty, removed ones that are waiting to
+ * be skipped over have MMC_DIRTY cleared */
+#define QE_IsRemoved(e)  (!(QE_Flags(e) & MMC_DIRTY))
+
 /* Found key/val len to nearest 4 bytes */
 #define ROUNDLEN(l)     ((l) += 3 - (((l)-1) & 3))  
 
@@ -123,6 +245,8 @@ int mmc_map_memory(mmap_cache* cache);
 int mmc_unmap_memory(mmap_cache* cache);
 int mmc_lock_page(mmap_cache* cache, MU32 p_offset);
 int mmc_unlock_page(mmap_cache * cache);
+int mmc_lock_range(mmap_cache* cache, MU32 offset, MU32 len);
+int mmc_unlock_range(mmap_cache * cache, MU32 offset, MU32 len);
 int mmc_close_fh(mmap_cache* cache);
 int _mmc_set_error(mmap_cache *cache, int err, char * error_string, ...);
 char* _mmc_get_def_share_filename(mmap_cache * cache);
@@ -0,0 +1,43 @@
+
+#########################
+
+use Test::More tests => 10;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+ok( defined $FC );
+
+# Keys written with plain set() are found by get_many()
+my @Keys = map { "key$_" } 1 .. 100;
+$FC->set($_, "val-$_") for @Keys;
+
+my @Vals = $FC->get_many(\@Keys);
+is( scalar(@Vals), 100, "get_many returns one value per key" );
+is_deeply( \@Vals, [ map { "val-$_" } @Keys ], "get_many values in request order" );
+
+# Missing keys return undef in place
+@Vals = $FC->get_many([ 'key1', 'nokey', 'key2', 'key1' ]);
+is_deeply( \@Vals, [ 'val-key1', undef, 'val-key2', 'val-key1' ], "get_many with missing and repeated keys" );
+
+is_deeply( [ $FC->get_many([]) ], [], "get_many with no keys" );
+
+# Stored undef and utf8 values
+$FC->set('undef', undef);
+$FC->set('utf8', "\x{263A}");
+@Vals = $FC->get_many([ 'undef', 'utf8' ]);
+ok( !defined $Vals[0], "get_many stored undef" );
+is( $Vals[1], "\x{263A}", "get_many utf8 value" );
+
+# Non-raw values are thawed
+my $FC2 = Cache::FastMmap->new(init_file => 1);
+$FC2->set("a$_", { v => $_ }) for 1 .. 20;
+@Vals = $FC2->get_many([ map { "a$_" } 1 .. 20 ]);
+is_deeply( \@Vals, [ map { { v => $_ } } 1 .. 20 ], "get_many thawed values" );
+
+ok( !defined eval { $FC->get_many('key1'); 1 }, "get_many needs array ref" );
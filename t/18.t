@@ -0,0 +1,49 @@
+
+#########################
+
+use Test::More tests => 15;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+ok( defined $FC );
+
+# Items stored by set_many() are normal keys
+my %KVs = map { ("key$_" => "val$_") } 1 .. 100;
+is( $FC->set_many(\%KVs), 100, "set_many stored all items" );
+is( $FC->get('key1'), 'val1', "get of set_many item" );
+is_deeply( [ $FC->get_many([ sort keys %KVs ]) ], [ @KVs{sort keys %KVs} ], "get_many of set_many items" );
+
+ok( $FC->set_many({ undef => undef, utf8 => "\x{263A}" }), "set_many undef/utf8" );
+ok( !defined $FC->get('undef'), "set_many stored undef" );
+is( $FC->get('utf8'), "\x{263A}", "set_many stored utf8" );
+
+# Expiry option applies to all items
+$FC->set_many({ e1 => 1, e2 => 2 }, { expire_time => 'now' });
+sleep(2);
+ok( !defined $FC->get('e1') && !defined $FC->get('e2'), "set_many expire_time" );
+
+# A large batch into a single page needs only one expunge run
+my $FC2 = Cache::FastMmap->new(init_file => 1, raw_values => 1, num_pages => 1, page_size => 65536);
+%KVs = map { ("k$_" => 'x' x 50) } 1 .. 300;
+is( $FC2->set_many(\%KVs), 300, "set_many grows slots for a big batch" );
+is( scalar(grep { defined } $FC2->get_many([ keys %KVs ])), 300, "all big batch items found" );
+
+# Write back mode, expunged dirty items get written back
+my %WB;
+my $FC3 = Cache::FastMmap->new(
+  init_file => 1, num_pages => 1, page_size => 8192,
+  write_action => 'write_back',
+  write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+$FC3->set_many({ map { ("a$_" => [ $_, 'x' x 150 ]) } 1 .. 20 });
+ok( !%WB, "no write back before expunge" );
+is( $FC3->set_many({ map { ("b$_" => [ 'y' x 100 ]) } 1 .. 30 }), 30, "set_many made space for batch" );
+ok( scalar(keys %WB) > 0, "set_many expunge wrote back dirty items" );
+my ($WBKey) = grep { /^a\d+$/ } keys %WB;
+is_deeply( $WB{$WBKey}, [ substr($WBKey, 1), 'x' x 150 ], "written back value thawed" );
@@ -0,0 +1,68 @@
+
+#########################
+
+use Test::More tests => 19;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+ok( defined $FC );
+
+my $Big = join '', map { chr(ord('a') + $_ % 26) } 1 .. 50000;
+ok( $FC->set('big', $Big), "set big value" );
+ok( $FC->set('utf8', "\x{263A}"), "set utf8 value" );
+
+# View of value data inside the cache
+my $Saved;
+my $Len = $FC->with_value('big', sub {
+  $Saved = \$_[0];
+  ok( !eval { $_[0] .= 'x'; 1 }, "view is read only" );
+  is( substr($_[0], 0, 5), 'bcdef', "view data" );
+  return length($_[0]);
+});
+is( $Len, 50000, "with_value returns callback result" );
+ok( !defined $$Saved, "view detached after with_value" );
+
+is( $FC->with_value('utf8', sub { $_[0] }), "\x{263A}", "utf8 view" );
+ok( !defined $FC->with_value('nokey', sub { $_[0] }), "not found view is undef" );
+
+# Dies in the callback must unlock the page
+ok( !eval { $FC->with_value('big', sub { die "oops\n" }); 1 }, "with_value passes on die" );
+is( $FC->get('big'), $Big, "page unlocked after die" );
+
+# Numbers stored natively by another handle on the same file
+my $NC = Cache::FastMmap->new(share_file => $FC->{share_file}, raw_values => 0);
+$NC->set('int', 42);
+$NC->set('num', 1.5);
+is( $FC->with_value('int', sub { $_[0] }), 42, "native integer view" );
+is( $FC->with_value('num', sub { $_[0] }), 1.5, "native float view" );
+
+# Stream straight to a file
+my $File = "/tmp/fc_get_to_fh.$$";
+open(my $FH, '>', $File) || die "Could not open $File: $!";
+is( $FC->get_to_fh('big', $FH), 50000, "get_to_fh bytes written" );
+ok( !defined $FC->get_to_fh('nokey', $FH), "get_to_fh not found" );
+close($FH);
+
+open($FH, '<', $File) || die "Could not open $File: $!";
+my $Data = do { local $/; <$FH> };
+close($FH);
+unlink($File);
+is( $Data, $Big, "get_to_fh data written" );
+
+open($FH, '+>', $File) || die "Could not open $File: $!";
+$FC->get_to_fh($_, $FH) for 'int', 'num';
+seek($FH, 0, 0);
+$Data = do { local $/; <$FH> };
+close($FH);
+unlink($File);
+is( $Data, "421.5", "get_to_fh native numbers" );
+
+my $Buf = "x" x 100;
+$FC->get_into('num', $Buf);
+is( $Buf, 1.5, "get_into native float" );
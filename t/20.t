@@ -0,0 +1,43 @@
+
+#########################
+
+use Test::More tests => 14;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+ok( defined $FC );
+
+$FC->set('a', 'x' x 1000);
+$FC->set('b', 'abc');
+$FC->set('utf8', "\x{263A}");
+$FC->set('undef', undef);
+
+my $Buf;
+ok( $FC->get_into('a', $Buf), "get_into found" );
+is( $Buf, 'x' x 1000, "get_into value" );
+
+# Shorter value reuses the same buffer
+ok( $FC->get_into('b', $Buf), "get_into found shorter" );
+is( $Buf, 'abc', "get_into shorter value" );
+
+ok( $FC->get_into('utf8', $Buf) && $Buf eq "\x{263A}", "get_into utf8 value" );
+
+# A byte string read into a buffer that held a character string
+$FC->set('bytes', "caf\xe9");
+ok( $FC->get_into('bytes', $Buf) && !utf8::is_utf8($Buf), "get_into clears utf8 flag" );
+is( $Buf, "caf\xe9", "get_into bytes after utf8 value" );
+ok( $FC->get_into('undef', $Buf) && !defined $Buf, "get_into stored undef" );
+ok( !$FC->get_into('nokey', $Buf) && !defined $Buf, "get_into not found" );
+
+# Non raw values and read_cb fall back to get()
+my $FC2 = Cache::FastMmap->new(init_file => 1, read_cb => sub { "read-$_[1]" });
+$FC2->set('c', [ 1, 2 ]);
+ok( $FC2->get_into('c', $Buf), "get_into non raw found" );
+is_deeply( $Buf, [ 1, 2 ], "get_into non raw value" );
+ok( $FC2->get_into('d', $Buf) && $Buf eq 'read-d', "get_into read_cb" );
@@ -0,0 +1,71 @@
+
+#########################
+
+use Test::More tests => 24;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1);
+ok( defined $FC );
+
+is( $FC->incr('a'), 1, "incr new counter" );
+is( $FC->incr('a'), 2, "incr existing counter" );
+is( $FC->incr('a', 10), 12, "incr with delta" );
+is( $FC->decr('a'), 11, "decr" );
+is( $FC->decr('a', 20), -9, "decr below zero" );
+is( $FC->incr('b', 5, 100), 105, "incr with initial value" );
+is( $FC->incr('big', 1, 2**40), 2**40 + 1, "64 bit counter" );
+
+# Counters read back as plain numbers
+is( $FC->get('a'), -9, "get counter" );
+is_deeply( [ $FC->get_many([ 'a', 'b', 'c' ]) ], [ -9, 105, undef ], "get_many counters" );
+my %Vals = map { $_->{key} => $_->{value} } $FC->get_keys(2);
+is( $Vals{b}, 105, "get_keys counter" );
+
+# Normal value can't be incremented, and set() replaces a counter
+$FC->set('c', [ 1 ]);
+ok( !defined $FC->incr('c'), "incr non-counter" );
+is_deeply( $FC->get('c'), [ 1 ], "non-counter unchanged" );
+$FC->set('a', 'abc');
+is( $FC->get('a'), 'abc', "set replaces counter" );
+
+# Digit strings are converted with raw values or native_scalars
+$FC->set('s', '41');
+is( $FC->incr('s'), 42, "incr native_scalars digit string" );
+my $RC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+$RC->set('n', '41');
+is( $RC->incr('n'), 42, "incr digit string" );
+$RC->set('m', '-3');
+is( $RC->incr('m', 3), 0, "incr negative digit string" );
+
+# Digit strings out of the 64 bit range aren't converted
+$RC->set('big', '9223372036854775808');
+ok( !defined $RC->incr('big', 0), "incr overflowing digit string" );
+is( $RC->get('big'), '9223372036854775808', "overflowing digit string unchanged" );
+$RC->set('min', '-9223372036854775808');
+is( $RC->incr('min', 0), '-9223372036854775808', "incr smallest digit string" );
+
+# Expiry applies to new counters
+$FC->incr('e', 1, 0, 1);
+is( $FC->get('e'), 1, "counter with expiry" );
+sleep 2;
+is( $FC->incr('e'), 1, "expired counter starts again" );
+
+# Atomic across processes
+my @Pids;
+for (1 .. 4) {
+  my $Pid = fork();
+  if (!$Pid) {
+    $FC->incr('shared') for 1 .. 500;
+    exit(0);
+  }
+  push @Pids, $Pid;
+}
+waitpid($_, 0) for @Pids;
+is( $FC->get('shared'), 2000, "counter atomic across processes" );
+
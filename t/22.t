@@ -0,0 +1,61 @@
+
+#########################
+
+use Test::More tests => 14;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1);
+ok( defined $FC );
+
+# Missing key has version 0, and set_if_version 0 only adds
+my ($Val, $Version) = $FC->get_with_version('a');
+ok( !defined $Val && $Version == 0, "missing key version 0" );
+ok( $FC->set_if_version('a', [ 1 ], 0), "add with version 0" );
+ok( !$FC->set_if_version('a', [ 2 ], 0), "add fails if exists" );
+
+($Val, $Version) = $FC->get_with_version('a');
+is_deeply( $Val, [ 1 ], "get_with_version value" );
+ok( $Version, "get_with_version version" );
+
+# Matching version stores, and changes the version
+ok( $FC->set_if_version('a', [ 3 ], $Version), "set with matching version" );
+my ($Val2, $Version2) = $FC->get_with_version('a');
+is_deeply( $Val2, [ 3 ], "new value stored" );
+ok( $Version2 != $Version, "version changed" );
+
+# Stale version fails
+ok( !$FC->set_if_version('a', [ 4 ], $Version), "set with stale version" );
+
+# Any other write changes the version
+$FC->set('a', [ 5 ]);
+ok( !$FC->set_if_version('a', [ 6 ], $Version2), "set() changes version" );
+$FC->incr('n');
+my (undef, $NVersion) = $FC->get_with_version('n');
+$FC->incr('n');
+ok( !$FC->set_if_version('n', 10, $NVersion), "incr() changes version" );
+
+# Optimistic updates across processes
+$FC->set('shared', 0);
+my @Pids;
+for (1 .. 4) {
+  my $Pid = fork();
+  if (!$Pid) {
+    for (1 .. 200) {
+      while (1) {
+        my ($V, $Ver) = $FC->get_with_version('shared');
+        last if $FC->set_if_version('shared', $V + 1, $Ver);
+      }
+    }
+    exit(0);
+  }
+  push @Pids, $Pid;
+}
+waitpid($_, 0) for @Pids;
+is( $FC->get('shared'), 800, "compare and swap atomic across processes" );
+
@@ -0,0 +1,56 @@
+
+#########################
+
+use Test::More tests => 16;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1, num_pages => 1, page_size => 65536);
+ok( defined $FC );
+
+ok( $FC->append('a', 'abc'), "append to missing key" );
+is( $FC->get('a'), 'abc', "new value" );
+ok( $FC->append('a', 'def'), "append to last item" );
+is( $FC->get('a'), 'abcdef', "appended value" );
+
+# Other writes in between so value has to move
+$FC->set('b', 'x');
+ok( $FC->append('a', 'ghi'), "append moves value" );
+$FC->set('c', 'y');
+ok( $FC->append('a', 'jkl'), "append into slack" );
+ok( $FC->prepend('a', '012'), "prepend" );
+is( $FC->get('a'), '012abcdefghijkl', "prepended value" );
+is( $FC->get('b') . $FC->get('c'), 'xy', "other values unchanged" );
+
+# Lots of appends interleaved with other writes
+my $Expect = '';
+for (1 .. 500) {
+  $FC->append('log', "event $_;");
+  $FC->set("other$_", $_) if $_ % 3 == 0;
+  $Expect .= "event $_;";
+}
+is( $FC->get('log'), $Expect, "many appends" );
+
+# Appending to stored undef, and counters
+$FC->set('u', undef);
+$FC->append('u', 'abc');
+is( $FC->get('u'), 'abc', "append to undef" );
+$FC->incr('n');
+ok( !$FC->append('n', '1'), "can't append to counter" );
+
+# Appends past the page size fail, leaving a consistent value
+my $Added = 0;
+for (1 .. 100) {
+  $Added++ if $FC->append('big', 'z' x 1000);
+}
+my $Big = $FC->get('big') || '';
+ok( $Added < 100 && length($Big) % 1000 == 0 && length($Big) < 65536 && $Big !~ /[^z]/, "append to full page" );
+
+my $SC = Cache::FastMmap->new(init_file => 1);
+ok( !eval { $SC->append('a', 'b'); 1 }, "append needs raw_values" );
+
@@ -0,0 +1,45 @@
+
+#########################
+
+use Test::More tests => 16;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1);
+ok( defined $FC );
+
+my $Data = join '', map { chr(65 + $_ % 26) } 0 .. 9999;
+$FC->set('a', $Data);
+$FC->set('undef', undef);
+
+is( $FC->get_range('a', 0, 10), substr($Data, 0, 10), "range from start" );
+is( $FC->get_range('a', 5000, 100), substr($Data, 5000, 100), "range in middle" );
+is( $FC->get_range('a', 9990, 100), substr($Data, 9990), "range clipped at end" );
+is( $FC->get_range('a', 9000), substr($Data, 9000), "range to end" );
+is( $FC->get_range('a', -5), substr($Data, -5), "negative offset" );
+is( $FC->get_range('a', 20000, 10), '', "offset past end" );
+
+my ($Part, $Total) = $FC->get_range('a', 100, 50);
+ok( $Part eq substr($Data, 100, 50) && $Total == 10000, "range and total length" );
+
+ok( !defined $FC->get_range('b', 0, 10), "missing key" );
+(undef, $Total) = $FC->get_range('b', 0, 10);
+ok( !defined $Total, "missing key total" );
+ok( !defined $FC->get_range('undef', 0, 10), "stored undef" );
+
+# Counters are returned as their decimal string, as with get()
+$FC->incr('c', 12345);
+is( $FC->get_range('c', 0, 5), "12345", "counter range" );
+($Part, $Total) = $FC->get_range('c', -3);
+ok( $Part eq "345" && $Total == 5, "counter range and total length" );
+$FC->decr('c', 12346);
+is( $FC->get_range('c', 0, 2), "-1", "negative counter range" );
+
+my $SC = Cache::FastMmap->new(init_file => 1);
+ok( !eval { $SC->get_range('a', 0, 1); 1 }, "get_range needs raw_values" );
+
@@ -0,0 +1,38 @@
+
+#########################
+
+use Test::More tests => 12;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1);
+ok( defined $FC );
+
+$FC->set('a', [ 1 ], 2);
+$FC->set('b', [ 2 ], 2);
+$FC->set('c', [ 3 ], 2);
+my (undef, $Version) = $FC->get_with_version('a');
+
+ok( $FC->touch('a', 10), "touch found" );
+ok( !$FC->touch('x', 10), "touch missing" );
+is_deeply( [ $FC->touch_many([ 'b', 'x', 'c' ], 'never') ], [ 1, 0, 1 ], "touch_many list" );
+is( scalar $FC->touch_many([ 'b', 'x' ], 'never'), 1, "touch_many count" );
+
+my %Expire = map { $_->{key} => $_->{expire_time} } $FC->get_keys(1);
+ok( $Expire{a} >= time() + 9, "touch set expire time" );
+is( $Expire{b}, 0, "touch_many never expire" );
+
+sleep 3;
+is_deeply( $FC->get('a'), [ 1 ], "touched value kept" );
+is_deeply( $FC->get('b'), [ 2 ], "touched many value kept" );
+ok( $FC->set_if_version('a', [ 4 ], $Version), "touch keeps version" );
+
+$FC->set('d', [ 4 ], 1);
+sleep 2;
+ok( !$FC->touch('d'), "can't touch expired value" );
+
@@ -0,0 +1,39 @@
+
+#########################
+
+use Test::More tests => 12;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, raw_values => 1, enable_stats => 1, expire_time => 0);
+ok( defined $FC );
+
+$FC->set('a', 'x' x 1000);
+$FC->set('b', 'abc', 100);
+$FC->set('undef', undef);
+$FC->set('e', 'abc', 1);
+$FC->get_statistics(1);
+
+ok( $FC->exists('a'), "exists" );
+ok( !$FC->exists('x'), "not exists" );
+ok( $FC->exists('undef'), "stored undef exists" );
+
+is_deeply( [ $FC->exists('a') ], [ 1, undef, 1000 ], "exists details never expire" );
+my ($Found, $TTL, $Length) = $FC->exists('b');
+ok( $Found && $TTL > 95 && $TTL <= 100 && $Length == 3, "exists details with expiry" );
+is_deeply( [ $FC->exists('x') ], [ 0, undef, undef ], "exists details missing" );
+
+is_deeply( [ $FC->exists_many([ 'a', 'x', 'b' ]) ], [ 1, 0, 1 ], "exists_many" );
+my @Details = $FC->exists_many([ 'x', 'a' ], 1);
+is_deeply( \@Details, [ [ 0, undef, undef ], [ 1, undef, 1000 ] ], "exists_many details" );
+
+is_deeply( [ $FC->get_statistics() ], [ 0, 0 ], "exists doesn't count as read" );
+
+sleep 2;
+ok( !$FC->exists('e'), "expired doesn't exist" );
+
@@ -0,0 +1,44 @@
+
+#########################
+
+use Test::More tests => 9;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+# Misses are checked against each page's bloom filter before
+#  locking, make sure that never hides keys that are there
+
+my $FC = Cache::FastMmap->new(init_file => 1, num_pages => 3, page_size => 8192, raw_values => 1);
+ok( defined $FC );
+
+# Enough keys to cause expunges, which rebuild the filters
+$FC->set("k$_", "v$_") for 1 .. 3000;
+
+my %InCache = map { $_ => 1 } $FC->get_keys(0);
+ok( keys(%InCache) > 100 && keys(%InCache) < 3000, "some keys expunged" );
+
+my @Bad = grep { ($InCache{"k$_"} ? "v$_" : '') ne ($FC->get("k$_") // '') } 1 .. 3000;
+ok( !@Bad, "get matches keys in cache" );
+
+my @Keys = map { "k$_" } 1 .. 3000;
+my @Vals = $FC->get_many(\@Keys);
+@Bad = grep { ($InCache{$Keys[$_]} ? "v" . ($_+1) : '') ne ($Vals[$_] // '') } 0 .. $#Keys;
+ok( !@Bad, "get_many matches keys in cache" );
+
+my @Exists = $FC->exists_many(\@Keys);
+@Bad = grep { !!$InCache{$Keys[$_]} != !!$Exists[$_] } 0 .. $#Keys;
+ok( !@Bad, "exists_many matches keys in cache" );
+
+ok( !(grep { defined $FC->get("missing$_") } 1 .. 1000), "missing keys not found" );
+
+# Cleared cache, then new values
+$FC->clear();
+ok( !(grep { defined $FC->get("k$_") } 1 .. 3000), "nothing found after clear" );
+$FC->set("k$_", "n$_") for 1 .. 50;
+ok( !(grep { $FC->get("k$_") ne "n$_" } 1 .. 50), "new values found after clear" );
+
@@ -0,0 +1,62 @@
+
+#########################
+
+use Test::More tests => 10;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+# Count read_cb calls in a separate cache, since leases mean the
+#  page isn't locked during the callback
+my $Calls = Cache::FastMmap->new(init_file => 1);
+
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  read_lease => 10,
+  read_cb => sub {
+    $Calls->incr($_[1]);
+    die "read failed\n" if $_[1] eq 'die';
+    return undef if $_[1] eq 'undef';
+    sleep 1;
+    return "value $_[1]";
+  },
+);
+ok( defined $FC );
+
+# Many processes missing on the same key at once only call read_cb once
+my @Pids;
+pipe(my $Read, my $Write);
+for (1 .. 5) {
+  my $Pid = fork();
+  if (!$Pid) {
+    close $Read;
+    my $Val = $FC->get('hot');
+    print $Write (($Val // 'undef') . "\n");
+    exit(0);
+  }
+  push @Pids, $Pid;
+}
+close $Write;
+my @Got = <$Read>;
+waitpid($_, 0) for @Pids;
+
+is( scalar(@Got), 5, "all processes got a result" );
+is( scalar(grep { $_ eq "value hot\n" } @Got), 5, "all processes got the value" );
+is( $Calls->get('hot'), 1, "read_cb called once" );
+
+# Placeholder isn't visible as a value
+is_deeply( [ $FC->get_keys(0) ], [ 'hot' ], "only value in cache" );
+
+# Lease is given up if read_cb dies or returns undef
+ok( !eval { $FC->get('die'); 1 }, "read_cb died" );
+ok( !eval { $FC->get('die'); 1 }, "read_cb died again without waiting" );
+is( $Calls->get('die'), 2, "read_cb called again after die" );
+
+$FC->get('undef');
+$FC->get('undef');
+is( $Calls->get('undef'), 2, "read_cb called again after undef" );
+
@@ -0,0 +1,51 @@
+
+#########################
+
+use Test::More tests => 18;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $Calls = 0;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  soft_expire_time => 1,
+  expire_time => 5,
+  read_cb => sub { $Calls++; return "new $_[1]"; },
+);
+ok( defined $FC );
+
+# Fresh value, no read_cb
+ok( $FC->set('abc', 'old'), "set" );
+is( $FC->get('abc'), 'old', "fresh get" );
+is( $Calls, 0, "no read_cb for fresh value" );
+
+# Stale value is refreshed by the get that finds it
+sleep 2;
+is( $FC->get('abc'), 'new abc', "stale get refreshes" );
+is( $Calls, 1, "read_cb called once" );
+is( $FC->get('abc'), 'new abc', "refreshed value is fresh" );
+is( $Calls, 1, "no more read_cb calls" );
+
+# Without read_cb, only the first caller is told to refresh
+my $FC2 = Cache::FastMmap->new(init_file => 1, raw_values => 1, read_lease => 2);
+ok( $FC2->set('abc', 'old', { soft_expire_time => 1 }), "set with soft_expire_time" );
+is_deeply( [ $FC2->get_with_status('abc') ], [ 'old', 0, 0 ], "fresh status" );
+sleep 2;
+is_deeply( [ $FC2->get_with_status('abc') ], [ 'old', 1, 1 ], "stale, refresh" );
+is_deeply( [ $FC2->get_with_status('abc') ], [ 'old', 1, 0 ], "stale, someone else refreshing" );
+is( $FC2->get('abc'), 'old', "get still returns stale value" );
+
+# Refresh handed out again once the refreshing caller has had its chance
+sleep 3;
+is_deeply( [ $FC2->get_with_status('abc') ], [ 'old', 1, 1 ], "refresh again after lease" );
+
+# Storing a new value makes it fresh
+ok( $FC2->set('abc', 'new'), "set new value" );
+is_deeply( [ $FC2->get_with_status('abc') ], [ 'new', 0, 0 ], "fresh again" );
+is_deeply( [ $FC2->get_with_status('def') ], [ undef, 0, 0 ], "missing key" );
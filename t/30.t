@@ -0,0 +1,59 @@
+
+#########################
+
+use Test::More tests => 13;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+# Expiry times are spread out over the jitter range
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  expire_time => 1000,
+  expire_jitter => 50,
+);
+ok( defined $FC );
+
+my $Now = time();
+$FC->set("key$_", "val$_") for 1 .. 100;
+my %Expires = map { $_->{expire_time} - $Now => 1 } $FC->get_keys(2);
+my @Bad = grep { $_ < 499 || $_ > 1001 } keys %Expires;
+ok( !@Bad, "expiry times in jitter range" );
+ok( keys(%Expires) > 10, "expiry times spread out" );
+
+# Values that take long to calculate compared to their expiry time
+#  are always expired early, quick ones never are
+my $Calls = 0;
+$FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  early_expire_beta => 1,
+);
+ok( defined $FC );
+
+$FC->set('slow', 'old', { expire_time => 5, recompute_time => 1000 });
+$FC->set('fast', 'old', { expire_time => 1000, recompute_time => 0.001 });
+$FC->set('unknown', 'old', { expire_time => 5 });
+ok( !defined $FC->get('slow'), "slow value expired early" );
+is( $FC->get('fast'), 'old', "fast value not expired early" );
+is( $FC->get('unknown'), 'old', "no recompute time, not expired early" );
+is_deeply( [ $FC->get_with_status('slow') ], [ 'old', 0, 1 ], "status says refresh" );
+
+# With a read_cb, the value is refreshed, and the new value (which
+#  never expires) isn't expired early again
+$FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  early_expire_beta => 1,
+  read_cb => sub { $Calls++; return "new $_[1]"; },
+);
+$FC->set('slow', 'old', { expire_time => 5, recompute_time => 1000 });
+is( $FC->get('slow'), 'new slow', "early expired value refreshed" );
+is( $Calls, 1, "read_cb called once" );
+is( $FC->get('slow'), 'new slow', "refreshed value kept" );
+is( $Calls, 1, "no more read_cb calls" );
@@ -0,0 +1,44 @@
+
+#########################
+
+use Test::More tests => 13;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my @Calls;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  read_many_cb => sub {
+    push @Calls, [ sort @{$_[1]} ];
+    return { map { $_ => [ "val $_" ] } grep { !/^none/ } @{$_[1]} };
+  },
+);
+ok( defined $FC );
+
+ok( $FC->set('a', [ 'cached a' ]), "set" );
+
+# One call for all the misses, across pages, with duplicates only once
+my @Keys = ('a', map({ "key$_" } 1 .. 30), 'key1', 'none1');
+my @Vals = $FC->get_many(\@Keys);
+is( scalar(@Calls), 1, "read_many_cb called once" );
+is_deeply( $Calls[0], [ sort(map({ "key$_" } 1 .. 30), 'none1') ], "with all missing keys" );
+is_deeply( $Vals[0], [ 'cached a' ], "cached value" );
+is_deeply( [ @Vals[1 .. 31] ], [ map({ [ "val key$_" ] } 1 .. 30), [ 'val key1' ] ], "read values" );
+ok( !defined $Vals[32], "value not found" );
+
+# Values are stored, not found ones are read again
+@Calls = ();
+@Vals = $FC->get_many(\@Keys);
+is_deeply( \@Calls, [ [ 'none1' ] ], "only missing key read again" );
+is_deeply( $Vals[30], [ 'val key30' ], "stored value" );
+
+# get() uses read_many_cb for a single key
+@Calls = ();
+is_deeply( $FC->get('key99'), [ 'val key99' ], "get uses read_many_cb" );
+is_deeply( \@Calls, [ [ 'key99' ] ], "with one key" );
+ok( !defined $FC->get('none2'), "get not found" );
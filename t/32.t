@@ -0,0 +1,116 @@
+
+#########################
+
+use Test::More tests => 31;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my %Written;
+my %Opts = (
+  num_pages => 1,
+  page_size => 8192,
+  raw_values => 1,
+  write_action => 'write_back',
+  write_cb => sub { $Written{$_[1]} = $_[2]; },
+);
+my $FC = Cache::FastMmap->new(%Opts, init_file => 1, write_behind_queue => '64k');
+ok( defined $FC );
+
+# Dirty items pushed out of the page go on the queue, not to write_cb
+$FC->set("key$_", "val$_" x 10) for 1 .. 200;
+ok( !%Written, "no write backs during set" );
+my $Queued = $FC->dirty_queue_length();
+ok( $Queued > 50, "items queued" );
+
+# Another process can flush the queue
+my $FC2 = Cache::FastMmap->new(%Opts, share_file => $FC->{share_file}, write_behind_queue => '64k');
+is( $FC2->flush_dirty(10), 10, "flush max items" );
+is( scalar(keys %Written), 10, "items written" );
+is( $Written{key1}, "val1" x 10, "oldest written first" );
+is( $FC2->flush_dirty(), $Queued - 10, "flush rest" );
+is( $FC->dirty_queue_length(), 0, "queue empty" );
+
+# empty() writes back everything, including the queue
+$FC->set("key$_", "new$_") for 1 .. 200;
+%Written = ();
+$FC->empty();
+is( scalar(keys %Written), 200, "empty writes back all" );
+is( $Written{key1}, "new1", "with latest value" );
+
+# Full queue falls back to writing back during set
+$FC = Cache::FastMmap->new(%Opts, init_file => 1, write_behind_queue => 1024);
+%Written = ();
+$FC->set("key$_", "val$_" x 10) for 1 .. 200;
+ok( scalar(keys %Written) > 0, "write backs when queue full" );
+$FC->flush_dirty();
+$FC->empty();
+is( scalar(keys %Written), 200, "all written back" );
+
+# Queued items are newer than the underlying store, so get() and
+#  get_many() return them rather than calling the read callbacks
+my %Store = map { ("key$_" => "old$_") } 1 .. 200;
+my $Reads = 0;
+$FC = Cache::FastMmap->new(%Opts, init_file => 1, write_behind_queue => '64k',
+  write_cb => sub { $Store{$_[1]} = $_[2]; },
+  read_cb => sub { $Reads++; $Store{$_[1]} },
+  read_many_cb => sub { $Reads++; +{ map { ($_ => $Store{$_}) } @{$_[1]} } },
+);
+$FC->set("key$_", "new$_") for 1 .. 200;
+ok( $FC->dirty_queue_length() && $Store{key1} eq "old1", "item queued, store not written" );
+is( $FC->get("key1"), "new1", "get returns queued value" );
+is_deeply( [ $FC->get_many([ "key1", "key2" ]) ], [ "new1", "new2" ], "get_many returns queued values" );
+is( $Reads, 0, "no read callbacks" );
+$FC->flush_dirty();
+is( $Store{key1}, "new1", "store written" );
+is( $FC->get("key1"), "new1", "get after flush" );
+
+# Removing items drops them from the queue too, so they're neither
+#  returned by get() nor written back
+my @Deleted;
+%Store = ();
+$FC = Cache::FastMmap->new(%Opts, init_file => 1, write_behind_queue => '64k',
+  namespaces => 16, tag_slots => 64,
+  write_cb => sub { $Store{$_[1]} = $_[2]; },
+  delete_cb => sub { push @Deleted, $_[1]; },
+);
+sub queue_items {
+  my ($Prefix, $Opts) = @_;
+  $FC->flush_dirty();
+  $FC->set("$Prefix:$_", "v$_", $Opts) for 1 .. 5;
+  $FC->set("fill:$_", "f" x 50) for 1 .. 150;
+  return !$FC->exists("$Prefix:1") && ($FC->get("$Prefix:1") || '') eq "v1";
+}
+
+ok( queue_items("r"), "queued for remove" );
+$FC->remove("r:1");
+ok( !defined $FC->get("r:1") && $Deleted[-1] eq "r:1", "remove" );
+
+ok( queue_items("m"), "queued for remove_matching" );
+$FC->remove_matching("m:*");
+ok( !defined $FC->get("m:1"), "remove_matching" );
+
+ok( queue_items("n", { namespace => "ns" }), "queued for invalidate_namespace" );
+$FC->invalidate_namespace("ns");
+ok( !defined $FC->get("n:1"), "invalidate_namespace" );
+
+ok( queue_items("t", { tags => [ "T", "U" ] }), "queued for invalidate_tag" );
+$FC->invalidate_tag("U");
+ok( !defined $FC->get("t:1"), "invalidate_tag" );
+
+$FC->flush_dirty();
+is( scalar(grep { /^[rmnt]:1$/ } keys %Store), 0, "removed items not written back" );
+is( $Store{"r:2"}, "v2", "others written back" );
+
+queue_items("c");
+$FC->clear();
+ok( !defined $FC->get("c:1") && !$FC->flush_dirty(), "clear" );
+
+# Expired queue items aren't returned
+queue_items("e", { expire_time => 1 });
+sleep 2;
+ok( !defined $FC->get("e:1"), "expired queue item" );
@@ -0,0 +1,47 @@
+
+#########################
+
+use Test::More tests => 10;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my %Written;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 89,
+  raw_values => 1,
+  write_action => 'write_back',
+  write_cb => sub { $Written{$_[1]} = $_[2]; },
+);
+ok( defined $FC );
+
+is( $FC->checkpoint(), 0, "nothing to checkpoint" );
+
+# Only written keys are dirty
+$FC->set("key$_", "val$_") for 1 .. 5;
+is( $FC->checkpoint(), 5, "checkpoint writes back dirty items" );
+is_deeply( \%Written, { map { ("key$_" => "val$_") } 1 .. 5 }, "with values" );
+
+# Items stay in the cache, but are clean
+is( $FC->get('key3'), 'val3', "still cached" );
+%Written = ();
+is( $FC->checkpoint(), 0, "nothing more to checkpoint" );
+
+# Overwrites, removes and incr keep dirty counts right
+$FC->set('key1', 'new1');
+$FC->set('key1', 'newer1');
+$FC->set('key2', 'new2');
+$FC->remove('key2');
+$FC->incr('count');
+is( $FC->checkpoint(), 2, "checkpoint after changes" );
+is_deeply( \%Written, { key1 => 'newer1', count => 1 }, "latest values" );
+
+# empty() has nothing left to write back
+%Written = ();
+$FC->empty();
+ok( !%Written, "all clean" );
@@ -0,0 +1,90 @@
+
+#########################
+
+use Test::More tests => 17;
+BEGIN { use_ok('Cache::FastMmap') };
+use Time::HiRes qw(sleep);
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my (%Written, $Calls, $Singles);
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  write_cb => sub { $Singles++; $Written{$_[1]} = $_[2]; },
+  write_many_cb => sub { $Calls++; $Written{$_->[0]} = $_->[1] for @{$_[1]}; },
+);
+ok( defined $FC );
+
+# set_many writes through with one call
+$FC->set_many({ map { ("key$_" => "val$_") } 1 .. 50 });
+is( $Calls, 1, "one write_many_cb call" );
+is( scalar(keys %Written), 50, "all written" );
+ok( !$Singles, "no single writes" );
+
+# A single set still uses the write_cb
+$FC->set("key1", "new1");
+is( $Singles, 1, "single write" );
+is( $Written{key1}, "new1", "value written" );
+
+# Only a write_many_cb given is used for single writes too
+($Calls, %Written) = (0);
+$FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  write_many_cb => sub { $Calls++; $Written{$_->[0]} = $_->[1] for @{$_[1]}; },
+);
+$FC->set("key1", "val1");
+ok( $Calls == 1 && $Written{key1} eq "val1", "write_many_cb for single write" );
+
+# Writes back dirty items expunged from a page in one go
+($Calls, %Written) = (0);
+$FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  page_size => 8192,
+  raw_values => 1,
+  write_action => 'write_back',
+  write_many_cb => sub { $Calls++; $Written{$_->[0]} = $_->[1] for @{$_[1]}; },
+);
+$FC->set("key$_", "val$_" x 10) for 1 .. 100;
+$FC->empty();
+is( scalar(keys %Written), 100, "all written back" );
+ok( $Calls < 20, "in batches" );
+
+# Repeated writes of the same key are coalesced
+($Calls, $Singles, %Written) = (0, 0);
+my @Batches;
+$FC = Cache::FastMmap->new(
+  init_file => 1,
+  raw_values => 1,
+  write_coalesce => 0.5,
+  write_cb => sub { $Singles++; $Written{$_[1]} = $_[2]; },
+  write_many_cb => sub { push @Batches, [ map { $_->[0] } @{$_[1]} ]; $Written{$_->[0]} = $_->[1] for @{$_[1]}; },
+);
+$FC->set("key$_", "val$_") for 1 .. 5;
+$FC->set("key1", "new1");
+$FC->set("key6", "val6");
+$FC->remove("key6");
+ok( !%Written, "writes held back" );
+is( $FC->get("key1"), "new1", "cache has latest value" );
+is( $FC->flush_writes(), 5, "flush writes" );
+is_deeply( \@Batches, [ [ map { "key$_" } 1 .. 5 ] ], "one batch in order without removed key" );
+is( $Written{key1}, "new1", "latest value written" );
+
+# Written by the first write after the window
+@Batches = ();
+$FC->set("key1", "val1");
+sleep 0.6;
+$FC->set("key2", "val2");
+is_deeply( \@Batches, [ [ "key1", "key2" ] ], "written after window" );
+
+# Written on cleanup
+($Singles, %Written) = (0);
+$FC->set("key3", "new3");
+$FC = undef;
+is( $Written{key3}, "new3", "written on cleanup" );
@@ -0,0 +1,91 @@
+
+#########################
+
+use Test::More tests => 26;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my ($Freezes, $Thaws) = (0, 0);
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  serializer => [
+    sub { $Freezes++; Storable::freeze($_[0]) },
+    sub { $Thaws++; Storable::thaw($_[0]) },
+  ],
+);
+ok( defined $FC );
+require Storable;
+
+# A raw view of the same file to see how values are stored
+my $Raw = Cache::FastMmap->new(share_file => $FC->{share_file}, raw_values => 1);
+
+my $Float = 0.1 + 0.2;
+my $Utf8 = "caf\x{e9} \x{263a}";
+$FC->set("str", "abc");
+$FC->set("int", -(2**40));
+$FC->set("float", $Float);
+$FC->set("undef", undef);
+$FC->set("utf8", $Utf8);
+$FC->set("ref", { a => [ 1, 2 ] });
+is( $Freezes, 1, "only reference frozen" );
+
+is( $FC->get("str"), "abc", "string" );
+is( $FC->get("int"), -(2**40), "integer" );
+ok( $FC->get("float") == $Float, "float exact" );
+ok( !defined $FC->get("undef"), "undef" );
+is( $FC->get("utf8"), $Utf8, "utf8 string" );
+is_deeply( $FC->get("ref"), { a => [ 1, 2 ] }, "reference" );
+is( $Thaws, 1, "only reference thawed" );
+
+is( $Raw->get("str"), "abc", "string stored as is" );
+is( $Raw->get("int"), -(2**40), "integer stored natively" );
+
+# Numbers that are also strings are stored as strings
+my $Num = 42;
+my $Str = "$Num";
+$FC->set("numstr", $Num);
+is( $Raw->get("numstr"), "42", "stringified number stored as string" );
+
+# Batch methods
+my %KVs = (a => "x", b => 7, c => [ 3 ], d => undef);
+is( $FC->set_many(\%KVs), 4, "set_many mixed values" );
+is_deeply( [ $FC->get_many([ qw(a b c d) ]) ], [ "x", 7, [ 3 ], undef ], "get_many mixed values" );
+$FC->multi_set("page", { e => "y", f => 1.5, g => { h => 1 } });
+is_deeply( $FC->multi_get("page", [ qw(e f g) ]), { e => "y", f => 1.5, g => { h => 1 } }, "multi_get mixed values" );
+my %Keys = map { $_->{key} => $_->{value} } $FC->get_keys(2);
+is_deeply( [ @Keys{qw(str int c)} ], [ "abc", -(2**40), [ 3 ] ], "get_keys values" );
+
+# Old behaviour, everything frozen
+$FC = Cache::FastMmap->new(init_file => 1, native_scalars => 0);
+$Raw = Cache::FastMmap->new(share_file => $FC->{share_file}, raw_values => 1);
+$FC->set("str", "abc");
+is( $FC->get("str"), "abc", "frozen string" );
+isnt( $Raw->get("str"), "abc", "stored frozen" );
+
+# Compressed values are all frozen
+$FC = Cache::FastMmap->new(init_file => 1, compress => 1);
+$FC->set("str", "abc" x 100);
+$FC->set("int", 12);
+is( $FC->get("str"), "abc" x 100, "compressed string" );
+is( $FC->get("int"), 12, "compressed integer" );
+
+# Native integers can be incremented like counters
+$FC = Cache::FastMmap->new(init_file => 1);
+$FC->set("n", 5);
+is( $FC->incr("n"), 6, "incr native integer" );
+is( $FC->get("n"), 6, "incremented value" );
+is( $FC->incr("n", -10), -4, "decrement native integer" );
+$FC->set("f", 1.5);
+ok( !defined $FC->incr("f"), "incr native float fails" );
+
+SKIP: {
+  skip "Sereal not installed", 1 if !eval { require Sereal::Encoder; require Sereal::Decoder; 1 };
+  $FC = Cache::FastMmap->new(init_file => 1, serializer => 'sereal');
+  $FC->set("ref", { a => 1 });
+  is_deeply( $FC->get("ref"), { a => 1 }, "sereal reference" );
+}
@@ -0,0 +1,58 @@
+
+#########################
+
+use Test::More tests => 12;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(init_file => 1, num_pages => 17, page_size => 16384);
+ok( defined $FC );
+
+$FC->set("key$_", { n => $_ }) for 1 .. 500;
+$FC->set("user:$_", $_) for 1 .. 50;
+$FC->set("old$_", 1, 1) for 1 .. 10;
+
+# All keys in batches, same as get_keys()
+my $Cursor = $FC->cursor(batch => 100);
+my (@Keys, $Batches);
+while (my @Items = $Cursor->next()) {
+  $Batches++;
+  ok( 0, "batch too big" ) if @Items > 100;
+  push @Keys, @Items;
+}
+is_deeply( [ sort @Keys ], [ sort $FC->get_keys(0) ], "all keys" );
+ok( $Batches >= 6, "in batches" );
+my @More = $Cursor->next();
+is( scalar(@More), 0, "nothing more" );
+
+# Values thawed in mode 2
+my %Vals = map { $_->{key} => $_->{value} } $FC->cursor(mode => 2, batch => 1000)->next();
+is_deeply( $Vals{key7}, { n => 7 }, "mode 2 value" );
+is( $Vals{"user:3"}, 3, "mode 2 scalar value" );
+
+# Prefix filter
+$Cursor = $FC->cursor(prefix => "user:", mode => 1);
+my @Users = map { $_->{key} } $Cursor->next(1000);
+is_deeply( [ sort @Users ], [ sort map { "user:$_" } 1 .. 50 ], "prefix filter" );
+
+# Skip expired
+sleep 2;
+my @Live = $FC->cursor(skip_expired => 1)->next(10000);
+is( scalar(grep { /^old/ } @Live), 0, "expired skipped" );
+is( scalar(@Live), 550, "others returned" );
+
+# Resume from a position in a new cursor
+$Cursor = $FC->cursor();
+my @First = $Cursor->next(200);
+my $Resumed = $FC->cursor(position => $Cursor->position());
+my @Rest;
+while (my @Items = $Resumed->next(150)) { push @Rest, @Items; }
+is( scalar(@First) + scalar(@Rest), 560, "resumed cursor gets the rest" );
+my %Seen;
+$Seen{$_}++ for @First, @Rest;
+is( scalar(keys %Seen), 560, "no duplicates" );
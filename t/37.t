@@ -0,0 +1,61 @@
+
+#########################
+
+use Test::More tests => 11;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my %Written;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 37,
+  page_size => 8192,
+  raw_values => 1,
+  write_action => 'write_back',
+  write_cb => sub { $Written{$_[1]} = $_[2]; },
+);
+ok( defined $FC );
+
+$FC->set("key$_", "val$_") for 1 .. 1000;
+my @All = sort $FC->get_keys(0);
+
+# Partitions split the keys with no overlap
+my @Parts = map { [ $FC->get_keys(0, [ $_, 4 ]) ] } 0 .. 3;
+is_deeply( [ sort map { @$_ } @Parts ], \@All, "partitions cover all keys" );
+ok( !grep({ !@$_ } @Parts), "each partition has keys" );
+
+# Cursors can use a partition too
+my $Cursor = $FC->cursor(partition => [ 2, 4 ], batch => 10);
+my @Keys;
+while (my @Items = $Cursor->next()) { push @Keys, @Items; }
+is_deeply( [ sort @Keys ], [ sort @{$Parts[2]} ], "cursor partition" );
+
+# Checkpoint one partition
+is( $FC->checkpoint([ 1, 4 ]), scalar(@{$Parts[1]}), "checkpoint partition" );
+is_deeply( [ sort keys %Written ], [ sort @{$Parts[1]} ], "only partition written" );
+
+# Clear a partition, others untouched
+$FC->clear([ 0, 4 ]);
+is( scalar(grep { defined $FC->get($_) } @{$Parts[0]}), 0, "partition cleared" );
+is( scalar(grep { defined $FC->get($_) } @{$Parts[3]}), scalar(@{$Parts[3]}), "other partition kept" );
+
+# Workers empty their own partitions at the same time
+my @Pids;
+for my $K (0 .. 2) {
+  my $Pid = fork();
+  if (!$Pid) {
+    my $Child = Cache::FastMmap->new(share_file => $FC->{share_file}, num_pages => 37, page_size => 8192, raw_values => 1);
+    $Child->clear([ $K, 3 ]);
+    exit(0);
+  }
+  push @Pids, $Pid;
+}
+waitpid($_, 0) for @Pids;
+is( scalar($FC->get_keys(0)), 0, "workers cleared everything" );
+
+ok( !eval { $FC->get_keys(0, [ 4, 4 ]); 1 }, "invalid partition" );
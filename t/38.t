@@ -0,0 +1,55 @@
+
+#########################
+
+use Test::More tests => 18;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my @Deleted;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 13,
+  delete_cb => sub { push @Deleted, $_[1]; },
+);
+ok( defined $FC );
+
+for my $U (1 .. 20) {
+  $FC->set("user:$U:$_", { u => $U, n => $_ }) for qw(name email x);
+}
+$FC->set("a*b", 1);
+$FC->set("axb", 2);
+$FC->set("caf\x{e9}:\x{263a}", 3);
+
+sub matching { return [ sort $FC->keys_matching(@_) ] }
+
+is_deeply( matching("user:1:*"), [ map { "user:1:$_" } qw(email name x) ], "prefix" );
+is_deeply( matching("user:?:x"), [ map { "user:$_:x" } 1 .. 9 ], "?" );
+is_deeply( matching("user:1[0-2]:x"), [ map { "user:$_:x" } 10 .. 12 ], "range" );
+is_deeply( matching("user:[!1]:x"), [ map { "user:$_:x" } 2 .. 9 ], "negated set" );
+is( scalar(@{matching("*:x")}), 20, "leading *" );
+is_deeply( matching("user:2*e*"), [ sort map { ("user:2:$_", "user:20:$_") } qw(email name) ], "several *" );
+is_deeply( matching("a\\*b"), [ "a*b" ], "escaped *" );
+is_deeply( matching("a*b"), [ "a*b", "axb" ], "unescaped *" );
+is_deeply( matching("user:3:name"), [ "user:3:name" ], "exact key" );
+my $Utf8 = "caf\x{e9}:*";
+utf8::upgrade($Utf8);
+is_deeply( matching($Utf8), [ "caf\x{e9}:\x{263a}" ], "utf8 key" );
+
+my %Vals = map { $_->{key} => $_->{value} } $FC->keys_matching("user:4:*", 2);
+is_deeply( $Vals{"user:4:email"}, { u => 4, n => "email" }, "mode 2 values" );
+
+# Remove with callbacks
+is( $FC->remove_matching("user:1*:*"), 33, "remove_matching count" );
+is_deeply( [ sort @Deleted ], [ sort map { my $U = $_; map { "user:$U:$_" } qw(name email x) } 1, 10 .. 19 ], "delete_cb called" );
+ok( !defined $FC->get("user:15:name") && defined $FC->get("user:2:name"), "only matches removed" );
+
+# By partition
+my $Total = 0;
+$Total += $FC->remove_matching("user:*", [ $_, 3 ]) for 0 .. 2;
+is( $Total, 27, "remove by partition" );
+is( scalar(@{matching("user:*")}), 0, "all removed" );
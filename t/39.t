@@ -0,0 +1,87 @@
+
+#########################
+
+use Test::More tests => 23;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 7,
+  namespaces => 16,
+  raw_values => 1,
+);
+ok( defined $FC );
+
+# Find two names that don't share a counter
+my ($A, $B) = ('user:1');
+for (2 .. 100) {
+  $B = "user:$_";
+  last if $FC->_ns_flags($A) != $FC->_ns_flags($B);
+}
+isnt( $FC->_ns_flags($A), $FC->_ns_flags($B), "different counters" );
+
+$FC->set("$A:$_", $_, { namespace => $A }) for 1 .. 20;
+$FC->set("$B:$_", $_, { namespace => $B }) for 1 .. 20;
+$FC->set("plain", "p");
+is( $FC->get("$A:5"), 5, "namespaced get" );
+ok( $FC->exists("$A:5"), "namespaced exists" );
+
+ok( $FC->invalidate_namespace($A), "invalidate" );
+is( scalar(grep { defined $FC->get("$A:$_") } 1 .. 20), 0, "namespace gone" );
+is( scalar(grep { defined $FC->get("$B:$_") } 1 .. 20), 20, "other namespace kept" );
+is( $FC->get("plain"), "p", "no namespace kept" );
+ok( !$FC->exists("$A:7"), "not exists" );
+
+# New writes to the namespace are valid again
+$FC->set("$A:1", "new", { namespace => $A });
+is( $FC->get("$A:1"), "new", "rewritten" );
+
+# Other processes see the invalidation
+my $FC2 = Cache::FastMmap->new(
+  share_file => $FC->{share_file},
+  num_pages => 7,
+  namespaces => 16,
+  raw_values => 1,
+);
+is( $FC2->get("$B:3"), 3, "other process sees item" );
+$FC2->invalidate_namespace($B);
+ok( !defined $FC->get("$B:3"), "invalidated by other process" );
+is( $FC->get("$A:1"), "new", "still there" );
+
+# set_many and set_if_version take a namespace too
+$FC->set_many({ map { ("m:$_" => $_) } 1 .. 10 }, { namespace => $A });
+my (undef, $Version) = $FC->get_with_version("v");
+ok( $FC->set_if_version("v", "vv", $Version, { namespace => $A }), "set_if_version" );
+is( $FC->get("m:4"), 4, "set_many" );
+$FC->invalidate_namespace($A);
+ok( !defined $FC->get("m:4") && !defined $FC->get("v"), "set_many/set_if_version invalidated" );
+
+# Invalidated items are dropped when pages are expunged
+$FC->invalidate_namespace($B);
+$FC->empty(1);
+is( scalar(grep { /^user/ } $FC->get_keys(0)), 0, "expunged" );
+is_deeply( [ $FC->get_keys(0) ], [ "plain" ], "only plain left" );
+
+# In place updates keep the namespace
+$FC->set("c", 1, { namespace => $A });
+$FC->append("c", "2");
+is( $FC->get("c"), "12", "append" );
+$FC->invalidate_namespace($A);
+ok( !defined $FC->get("c"), "appended item invalidated" );
+
+# Items don't become valid again when the low bits of the
+# generation come round again
+$FC->set("w", 1, { namespace => $A });
+$FC->invalidate_namespace($A) for 1 .. 65536;
+ok( !defined $FC->get("w"), "still invalid after 65536 bumps" );
+
+# Without namespaces, invalidate does nothing
+my $FC3 = Cache::FastMmap->new(init_file => 1, num_pages => 7);
+$FC3->set("x", 1, { namespace => "n" });
+ok( !$FC3->invalidate_namespace("n") && $FC3->get("x") == 1, "no namespaces" );
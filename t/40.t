@@ -0,0 +1,87 @@
+
+#########################
+
+use Test::More tests => 23;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Insert your test code below, the Test::More module is use()ed here so read
+# its man page ( perldoc Test::More ) for help writing this test script.
+
+my @Deleted;
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 7,
+  tag_slots => 64,
+  raw_values => 1,
+  delete_cb => sub { push @Deleted, $_[1]; },
+);
+ok( defined $FC );
+
+ok( $FC->set("frag:$_", "f$_", { tags => "product:42" }), "set tagged" ) for 1;
+$FC->set("frag:$_", "f$_", { tags => "product:42" }) for 2 .. 20;
+$FC->set("page:$_", "p$_", { tags => [ "product:42", "user:7" ] }) for 1 .. 5;
+$FC->set("other:$_", "o$_", { tags => "product:43" }) for 1 .. 10;
+$FC->set("plain:$_", "x$_") for 1 .. 10;
+is( $FC->get("frag:3"), "f3", "tagged get" );
+
+# Re-setting without tags stops the item depending on them
+$FC->set("frag:20", "untagged");
+
+is( $FC->invalidate_tag("user:7"), 5, "invalidate one tag" );
+is( scalar(grep { defined $FC->get("page:$_") } 1 .. 5), 0, "multi tagged items gone" );
+is( scalar(grep { defined $FC->get("frag:$_") } 1 .. 19), 19, "other tag kept" );
+
+is( $FC->invalidate_tag("product:42"), 19, "invalidate other tag" );
+is( scalar(grep { defined $FC->get("frag:$_") } 1 .. 19), 0, "tagged items gone" );
+is( $FC->get("frag:20"), "untagged", "retagged item kept" );
+is( scalar(grep { defined $FC->get("other:$_") } 1 .. 10), 10, "different tag kept" );
+is( scalar(grep { defined $FC->get("plain:$_") } 1 .. 10), 10, "untagged kept" );
+is( scalar(@Deleted), 24, "delete_cb called" );
+is( $FC->invalidate_tag("product:42"), 0, "nothing left" );
+
+# Re-setting with different tags drops the old ones
+$FC->set("k", "a", { tags => "A" });
+$FC->set("k", "b", { tags => [ "B", "C" ] });
+$FC->invalidate_tag("A");
+is( $FC->get("k"), "b", "old tag dropped" );
+$FC->invalidate_tag("B");
+ok( !defined $FC->get("k"), "new tag kept" );
+
+# set_many and the skip_lock path of set() (used by get_and_set())
+#  take tags too
+$FC->set_many({ map { ("many:$_" => $_) } 1 .. 10 }, { tags => "M" });
+my (undef, $Unlock) = $FC->get("locked", { skip_unlock => 1 });
+$FC->set("locked", 1, { skip_lock => \$Unlock, tags => "M" });
+is( $FC->invalidate_tag("M"), 11, "set_many and skip_lock tagged" );
+ok( !grep({ defined $FC->get($_) } "locked", map { "many:$_" } 1 .. 10), "all gone" );
+
+# set_if_version tags too
+$FC->set("a", 1);
+my (undef, $Ver) = $FC->get_with_version("a");
+ok( $FC->set_if_version("a", 2, $Ver, { tags => "T" }), "set_if_version tagged" );
+$FC->invalidate_tag("T");
+ok( !defined $FC->get("a"), "set_if_version invalidated" );
+
+# Other processes share the index
+my $FC2 = Cache::FastMmap->new(
+  share_file => $FC->{share_file},
+  num_pages => 7,
+  tag_slots => 64,
+  raw_values => 1,
+);
+is( $FC2->invalidate_tag("product:43"), 10, "other process invalidate" );
+
+# When a page runs out of references, tagged items aren't stored,
+#  but invalidation still finds everything that was
+my $FC3 = Cache::FastMmap->new(init_file => 1, num_pages => 3, tag_slots => 4, raw_values => 1);
+my $Stored = grep { $FC3->set("t:$_", $_, { tags => "t" }) } 1 .. 30;
+$FC3->invalidate_tag("t");
+ok( $Stored < 30 && !grep({ defined $FC3->get("t:$_") } 1 .. 30), "full index" );
+
+# Without tag_slots, tags are ignored
+my $FC4 = Cache::FastMmap->new(init_file => 1, num_pages => 3, raw_values => 1);
+$FC4->set("x", 1, { tags => "t" });
+ok( !$FC4->invalidate_tag("t") && $FC4->get("x") == 1, "no tag index" );
@@ -79,6 +79,15 @@ int mmc_open_cache_file(mmap_cache* cache, int * do_init) {
         return -1;
       }
     }
+
+    /* And the dirty item counts and write behind queue after the pages */
+    for (i = cache->c_size - cache->c_num_pages * cache->c_page_size; i > 0; i -= cache->c_page_size) {
+      int len = i < (int)cache->c_page_size ? i : (int)cache->c_page_size;
+      if (write(res, tmp, len) != len) {
+        _mmc_set_error(cache, errno, "Write to share file %s failed", cache->share_file);
+        return -1;
+      }
+    }
     free(tmp);
 
     /* Later on initialise page structures */
@@ -137,6 +146,10 @@ int mmc_close_fh(mmap_cache* cache) {
 }
 
 int mmc_lock_page(mmap_cache* cache, MU32 p_offset) {
+  return mmc_lock_range(cache, p_offset, cache->c_page_size);
+}
+
+int mmc_lock_range(mmap_cache* cache, MU32 offset, MU32 len) {
   struct flock lock;
   int old_alarm, alarm_left = 10;
   int lock_res = -1;
@@ -144,8 +157,8 @@ int mmc_lock_page(mmap_cache* cache, MU32 p_offset) {
   /* Setup fcntl locking structure */
   lock.l_type = F_WRLCK;
   lock.l_whence = SEEK_SET;
-  lock.l_start = p_offset;
-  lock.l_len = cache->c_page_size;
+  lock.l_start = offset;
+  lock.l_len = len;
 
   if (cache->catch_deadlocks)
     old_alarm = alarm(alarm_left);
@@ -184,20 +197,26 @@ int mmc_lock_page(mmap_cache* cache, MU32 p_offset) {
 }
 
 int mmc_unlock_page(mmap_cache * cache) {
+  mmc_unlock_range(cache, cache->p_offset, cache->c_page_size);
+
+  /* Set to bad value while page not locked */
+  cache->p_cur = -1;
+
+  return 0;
+}
+
+int mmc_unlock_range(mmap_cache * cache, MU32 offset, MU32 len) {
   struct flock lock;
 
   /* Setup fcntl locking structure */
   lock.l_type = F_UNLCK;
   lock.l_whence = SEEK_SET;
-  lock.l_start = cache->p_offset;
-  lock.l_len = cache->c_page_size;
+  lock.l_start = offset;
+  lock.l_len = len;
 
-  /* And unlock page */
+  /* And unlock range */
   fcntl(cache->fh, F_SETLKW, &lock);
 
-  /* Set to bad value while page not locked */
-  cache->p_cur = -1;
-
   return 0;
 }
 
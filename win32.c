@@ -160,13 +160,17 @@ int mmc_unmap_memory(mmap_cache* cache) {
 }
 
 int mmc_lock_page(mmap_cache* cache, MU32 p_offset) {
+    return mmc_lock_range(cache, p_offset, cache->c_page_size);
+}
+
+int mmc_lock_range(mmap_cache* cache, MU32 offset, MU32 len) {
     OVERLAPPED lock;
     DWORD lock_res, bytesTransfered;
     memset(&lock, 0, sizeof(lock));
-    lock.Offset = p_offset;
+    lock.Offset = offset;
     lock.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
   
-    if (LockFileEx(cache->fh, 0, 0, cache->c_page_size, 0, &lock) == 0) {
+    if (LockFileEx(cache->fh, 0, 0, len, 0, &lock) == 0) {
         _mmc_set_error(cache, GetLastError(), "LockFileEx failed");
         return -1;
     }
@@ -182,15 +186,20 @@ int mmc_lock_page(mmap_cache* cache, MU32 p_offset) {
 }
 
 int mmc_unlock_page(mmap_cache* cache) {
+    mmc_unlock_range(cache, cache->p_offset, cache->c_page_size);
+    
+    /* Set to bad value while page not locked */
+    cache->p_cur = ~0; /* ~0 = -1, but unsigned */    
+}
+
+int mmc_unlock_range(mmap_cache* cache, MU32 offset, MU32 len) {
     OVERLAPPED lock;
     memset(&lock, 0, sizeof(lock));
-    lock.Offset = cache->p_offset;
+    lock.Offset = offset;
     lock.hEvent = 0;
   
-    UnlockFileEx(cache->fh, 0, cache->c_page_size, 0, &lock);
-    
-    /* Set to bad value while page not locked */
-    cache->p_cur = ~0; /* ~0 = -1, but unsigned */    
+    UnlockFileEx(cache->fh, 0, len, 0, &lock);
+    return 0;
 }
 
 /*